@@ -22,11 +22,31 @@
 #include "ns3/end-device-lora-mac.h"
 #include "ns3/file-helper.h"
 #include "ns3/names.h"
+#include "ns3/config.h"
 #include <algorithm>
 #include <ctime>
 #include <time.h>
 #include <math.h>
 #include "ns3/lora-tx-current-model.h"
+#include "ns3/mac-command-pool.h"
+#include "ns3/lora-on-air-time-cache.h"
+#include "ns3/fleet-periodic-sender.h"
+#include "ns3/lora-packet-pool.h"
+#include "ns3/energy-aware-adr-component.h"
+#include "ns3/lora-sweep-runner.h"
+#include "ns3/lora-results-sink.h"
+#include "ns3/lora-table-writer.h"
+#include "ns3/lora-result-cache.h"
+#include "ns3/lora-replication-runner.h"
+#include "ns3/lora-phase-profiler.h"
+#include "ns3/lora-progress-monitor.h"
+#include "ns3/lora-checkpoint.h"
+#include "ns3/lora-topology-cache.h"
+#include "ns3/cached-propagation-loss-model.h"
+#include "ns3/lora-counter-rng.h"
+#include "ns3/periodic-sender.h"
+#include "ns3/lora-radio-energy-model.h"
+#include "ns3/basic-energy-source.h"
 #include "ns3/network-server-helper.h"
 #include "ns3/correlated-shadowing-propagation-loss-model.h"
 #include "ns3/building-penetration-loss.h"
@@ -42,6 +62,14 @@
 #include "ns3/double.h"
 #include <cstdlib>
 #include <map>
+#include <set>
+#include <chrono>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sstream>
+#include <cstdio>
+#include <limits>
+#include <cmath>
 
 
 
@@ -52,71 +80,477 @@ NS_LOG_COMPONENT_DEFINE ("LoraEnergyModelExample");
 
 
 
-// Test if the file is empty
-bool is_empty(std::ifstream& pFile)
+// Application bytes and frames sent by the end devices
+uint64_t appBytesSent = 0;
+uint64_t framesSent = 0;
+uint64_t aggregatedFrames = 0;
+
+void
+OnTxQueueDelay (Ptr<const Packet> packet, Time delay)
+{
+  appBytesSent += packet->GetSize ();
+}
+
+void
+OnStartSending (Ptr<const Packet> packet, uint32_t nodeId)
+{
+  framesSent++;
+}
+
+void
+OnAggregatedFrame (Ptr<const Packet> packet, uint32_t nPayloads)
+{
+  aggregatedFrames++;
+}
+
+// Resident set size of the process, in bytes, or 0 if it is not available
+uint64_t
+GetResidentBytes (void)
+{
+  std::ifstream statm ("/proc/self/statm");
+  uint64_t totalPages = 0;
+  uint64_t residentPages = 0;
+  statm >> totalPages >> residentPages;
+  return residentPages * sysconf (_SC_PAGESIZE);
+}
+
+// Columns of the table of the end devices
+std::vector<std::string>
+GetDeviceColumns (void)
 {
-	return pFile.peek() == std::ifstream::traits_type::eof();
+  std::vector<std::string> columns;
+  columns.push_back ("Node");
+  columns.push_back ("PosX");
+  columns.push_back ("PosY");
+  columns.push_back ("PosZ");
+  columns.push_back ("Algoritmo");
+  columns.push_back ("RunSeed");
+  columns.push_back ("Seed");
+  columns.push_back ("DataRate");
+  columns.push_back ("TxPowerdBm");
+  columns.push_back ("batteryEnergyFinal");
+  columns.push_back ("depletionTime");
+  return columns;
 }
 
+// One row per end device, with its position and its state at the end of
+// the run, so that no table has to be joined with another. The rows are
+// returned one after the other, with NaN for the missing values.
+std::vector<double>
+GetDeviceRows (NodeContainer endDevices, DeviceEnergyModelContainer deviceModels,
+               EnergySourceContainer sources, int algoritmo, uint32_t runSeed,
+               int seed, Time timeOffset)
+{
+  std::vector<double> rows;
+  for (uint32_t i = 0; i < endDevices.GetN (); i++)
+    {
+      Ptr<Node> node = endDevices.Get (i);
+      Vector pos = node->GetObject<MobilityModel> ()->GetPosition ();
+      Ptr<EndDeviceLoraMac> mac =
+        DynamicCast<LoraNetDevice> (node->GetDevice (0))->GetMac ()->GetObject<EndDeviceLoraMac> ();
+      Ptr<LoraRadioEnergyModel> model =
+        DynamicCast<LoraRadioEnergyModel> (deviceModels.Get (i));
+
+      rows.push_back (node->GetId ());
+      rows.push_back (pos.x);
+      rows.push_back (pos.y);
+      rows.push_back (pos.z);
+      rows.push_back (algoritmo);
+      rows.push_back (runSeed);
+      rows.push_back (seed);
+      rows.push_back (mac->GetDataRate ());
+      rows.push_back (mac->GetTransmissionPower ());
+      rows.push_back (sources.Get (i)->GetRemainingEnergy ());
+      rows.push_back (model && model->IsDepleted () ?
+                      (timeOffset + model->GetDepletionTime ()).GetSeconds () :
+                      std::numeric_limits<double>::quiet_NaN ());
+    }
+  return rows;
+}
+
+// Write the rows of the end devices to their table
+void
+WriteDeviceTable (const std::string &fileName, LoraTableWriter::Format format,
+                  const std::vector<double> &rows)
+{
+  LoraTableWriter table (fileName, GetDeviceColumns (), format);
+  for (std::size_t i = 0; i < rows.size (); i++)
+    {
+      if (std::isnan (rows[i]))
+        {
+          table.AddEmpty ();
+        }
+      else
+        {
+          table.Add (rows[i]);
+        }
+    }
+
+  if (!table.Close ())
+    {
+      std::cerr << "Erro: tabela dos dispositivos nao gravada em " << fileName << "\n";
+    }
+}
 
-void PrintPositions(NodeContainer nodes, std::string filename, int algoritmo)
+// The result cache keeps the rows of the end devices of a run next to its
+// results row, under a configuration of their own
+std::string
+GetDeviceTableConfig (const std::string &config)
+{
+  return config + ";table=devices";
+}
 
+// Write the table of the end devices of a run found in the result cache
+void
+RestoreDeviceTable (const std::string &cacheDir, const std::string &config,
+                    const std::string &fileName, LoraTableWriter::Format format)
 {
-	std::ifstream inFile(filename.c_str());
-	bool fileIsEmpty = is_empty(inFile);
-	inFile.close();
-
-	std::ofstream outFile;
-
-	if (fileIsEmpty){
-		outFile.open(filename.c_str(), std::ios::out); //abre em modo de escrita
-		outFile << "Nó,PosX,PosY,PosZ,Algoritmo" << std::endl;
-
-	}
-	outFile.open(filename.c_str(), std::ios::app); // abre em modo de anexação
-	for (NodeContainer::Iterator it = nodes.Begin(); it != nodes.End(); ++it) {
-	        Ptr<Node> node = *it;
-	        Ptr<MobilityModel> mobility = node->GetObject<MobilityModel>();
-	        Vector pos = mobility->GetPosition();
-	//        outFile << "Node " << node->GetId() << ": x=" << pos.x << ", y=" << pos.y << ", z=" << pos.z << std::endl;
-	        outFile << node->GetId()<< "," << pos.x << "," << pos.y << "," << pos.z << "," << algoritmo << std::endl;
-	}
-//	outFile << "--" << std::endl;
-	outFile.close();
+  std::vector<double> rows;
+  if (LoraResultCache (cacheDir).Lookup (GetDeviceTableConfig (config), rows)
+      && rows.size () % GetDeviceColumns ().size () == 0)
+    {
+      WriteDeviceTable (fileName, format, rows);
+    }
+  else
+    {
+      std::cerr << "Erro: tabela dos dispositivos nao encontrada no cache\n";
+    }
 }
 
 // To be used in tic toc time counter
 clock_t startTimer;
 time_t beginTimer;
+std::chrono::steady_clock::time_point beginSteady;
 //
 // Implementation of tic, i.e., start time counter
 void
 tic()
 {
-	beginTimer = time(&beginTimer);
-	struct tm * timeinfo;
-	timeinfo = localtime(&beginTimer);
-	std::cout << "simulation start at: " << asctime(timeinfo) << std::endl;
+  beginTimer = time (&beginTimer);
+  beginSteady = std::chrono::steady_clock::now ();
+  struct tm * timeinfo;
+  timeinfo = localtime (&beginTimer);
+  std::cout << "simulation start at: " << asctime (timeinfo) << std::endl;
 }
 // implementation of toc, i.e., stop time counter
 double
 toc()
 {
-	time_t finishTimer = time(&finishTimer);
-	double simTime = difftime(finishTimer, beginTimer) / 60.0;
-	struct tm * timeinfo;
-	timeinfo = localtime(&finishTimer);
-	std::cout << "simulation finished at: " << asctime(timeinfo) << std::endl;
-	//
-	std::cout << "Time elapsed: " << simTime << " minutes" << std::endl;
-	//
-	return simTime;
+  time_t finishTimer = time (&finishTimer);
+  // The monotonic clock, to the microsecond
+  double simTime = std::chrono::duration<double>
+      (std::chrono::steady_clock::now () - beginSteady).count () / 60.0;
+  struct tm * timeinfo;
+  timeinfo = localtime (&finishTimer);
+  std::cout << "simulation finished at: " << asctime (timeinfo) << std::endl;
+  //
+  std::cout << "Time elapsed: " << simTime << " minutes" << std::endl;
+  //
+  return simTime;
+}
+
+
+// Apply the "--name=value" overrides of a sweep point
+void
+ParsePoint (CommandLine &cmd, char *program, const LoraSweepRunner::Job &point)
+{
+  std::vector<std::string> args (1, program);
+  args.insert (args.end (), point.args.begin (), point.args.end ());
+  std::vector<char *> argv;
+  for (std::size_t i = 0; i < args.size (); i++)
+    {
+      argv.push_back (&args[i][0]);
+    }
+  cmd.Parse (argv.size (), argv.data ());
+}
+
+
+// Metrics whose confidence intervals decide how many runs a configuration
+// needs: the remaining energy and the PDR of the run
+std::vector<double>
+GetReplicationMetrics (const std::vector<std::string> &columns, const std::vector<double> &row)
+{
+  std::map<std::string, double> values;
+  for (std::size_t i = 0; i < columns.size (); i++)
+    {
+      values[columns[i]] = row[i];
+    }
+  std::vector<double> metrics;
+  metrics.push_back (values["batteryEnergyFinal"]);
+  metrics.push_back (values["PHYTotal"] > 0 ?
+                     values["PHYSuccessful"] / values["PHYTotal"] :
+                     std::numeric_limits<double>::quiet_NaN ());
+  return metrics;
+}
+
+// Set the row of a result cache hit. The profiler columns were measured by
+// the run that stored the row, not by this one: they are left empty.
+void
+SetCachedRow (LoraResultsSink &results, const std::vector<std::string> &columns,
+              const std::vector<std::string> &phases, std::vector<double> row)
+{
+  std::set<std::string> profilerColumns;
+  for (std::size_t i = 0; i < phases.size (); i++)
+    {
+      profilerColumns.insert (phases[i] + "Seconds");
+      profilerColumns.insert (phases[i] + "Events");
+      profilerColumns.insert (phases[i] + "PeakRssMB");
+    }
+  profilerColumns.insert ("runEventsPerSecond");
+  for (std::size_t i = 0; i < columns.size (); i++)
+    {
+      if (profilerColumns.count (columns[i]))
+        {
+          row[i] = std::numeric_limits<double>::quiet_NaN ();
+        }
+    }
+  results.SetRow (row);
+}
+
+// Print the replications of each configuration, and write them as a table
+void
+ReportReplications (const LoraReplicationRunner &replication,
+                    const std::vector<LoraSweepRunner::Job> &jobs,
+                    const std::string &fileName, LoraTableWriter::Format format)
+{
+  std::vector<std::string> columns;
+  columns.push_back ("Configuration");
+  columns.push_back ("Runs");
+  columns.push_back ("Converged");
+  columns.push_back ("batteryEnergyFinalMean");
+  columns.push_back ("batteryEnergyFinalHalfWidth");
+  columns.push_back ("PDRMean");
+  columns.push_back ("PDRHalfWidth");
+  LoraTableWriter table (fileName, columns, format);
+
+  for (uint32_t i = 0; i < jobs.size (); i++)
+    {
+      std::cout << "Configuration " << i << ":";
+      for (std::size_t j = 0; j < jobs[i].args.size (); j++)
+        {
+          std::cout << " " << jobs[i].args[j];
+        }
+      std::cout << ", " << replication.GetNRuns (i) << " runs" <<
+        (replication.IsConverged (i) ? "" : " (not converged)") <<
+        ", batteryEnergyFinal " << replication.GetMean (i, 0) << " +- " <<
+        replication.GetHalfWidth (i, 0) << ", PDR " << replication.GetMean (i, 1) <<
+        " +- " << replication.GetHalfWidth (i, 1) << std::endl;
+
+      table.Add (i);
+      table.Add (replication.GetNRuns (i));
+      table.Add (replication.IsConverged (i));
+      table.Add (replication.GetMean (i, 0));
+      table.Add (replication.GetHalfWidth (i, 0));
+      table.Add (replication.GetMean (i, 1));
+      table.Add (replication.GetHalfWidth (i, 1));
+    }
+  table.Close ();
+}
+
+// A path relative to the current directory, made absolute so that it
+// still holds after a forked point changes directory
+std::string
+GetAbsolutePath (const std::string &path)
+{
+  if (path.empty () || path[0] == '/')
+    {
+      return path;
+    }
+  char cwd[4096];
+  if (getcwd (cwd, sizeof (cwd)))
+    {
+      return std::string (cwd) + "/" + path;
+    }
+  return path;
+}
+
+// Points of the sweep or sweepFile parameter, none without a sweep. The run
+// time of a point grows with its number of uplinks.
+std::vector<LoraSweepRunner::Job>
+GetSweepJobs (const std::string &sweep, const std::string &sweepFile, int nDevices,
+              int hours, double appPeriodsSeconds, double ciTarget)
+{
+  std::vector<LoraSweepRunner::Job> jobs;
+  if (sweep.empty () && sweepFile.empty ())
+    {
+      return jobs;
+    }
+  jobs = sweepFile.empty () ?
+    LoraSweepRunner::ParseGrid (sweep) : LoraSweepRunner::ParseList (sweepFile);
+
+  for (std::size_t i = 0; i < jobs.size (); i++)
+    {
+      jobs[i].cost = jobs[i].GetValue ("nDevices", nDevices) *
+        jobs[i].GetValue ("hours", hours) /
+        jobs[i].GetValue ("appPeriodsSeconds", appPeriodsSeconds);
+      if (ciTarget > 0 && jobs[i].GetValue ("runSeed", -1) >= 0)
+        {
+          NS_FATAL_ERROR ("With ciTarget, the runSeeds are chosen by the replications");
+        }
+    }
+  return jobs;
+}
+
+// forkAfterSetup only lets the points change the parameters of the run
+// phase, since they share the scenario
+void
+CheckForkedJobs (const std::vector<LoraSweepRunner::Job> &jobs)
+{
+  for (std::size_t i = 0; i < jobs.size (); i++)
+    {
+      for (std::size_t j = 0; j < jobs[i].args.size (); j++)
+        {
+          const std::string &arg = jobs[i].args[j];
+          std::string name = arg.substr (2, arg.find ('=') - 2);
+          if (name != "runSeed" && name != "txPowerdBm"
+              && name != "appPeriodsSeconds" && name != "hours")
+            {
+              NS_FATAL_ERROR ("forkAfterSetup cannot vary " << name);
+            }
+        }
+    }
+}
+
+// Run the points of a sweep in child processes, one run per point or, with
+// replicate, as many as each configuration needs. A child gets the point
+// it runs, and the run of its replication in run. The parent gets -1 once
+// the sweep is done and printed, and the number of failed points.
+int
+RunSweep (const std::vector<LoraSweepRunner::Job> &jobs, uint32_t nWorkers,
+          bool replicate, LoraReplicationRunner &replication, uint32_t &run,
+          const std::string &what, const std::string &outputPrefix,
+          const std::string &resultsName, LoraTableWriter::Format format,
+          uint32_t &nFailed)
+{
+  LoraSweepRunner runner (nWorkers);
+  std::cout << "Sweep: " << jobs.size () << " " << what << " on " <<
+    runner.GetNWorkers () << " processes" << std::endl;
+  int point = replicate ? replication.Run (jobs, run) : runner.Run (jobs);
+  if (point < 0)
+    {
+      nFailed = replicate ? replication.GetNFailed () : runner.GetNFailed ();
+      std::cout << "Sweep done, " << nFailed <<
+        " points failed, results in " << resultsName << std::endl;
+      if (replicate)
+        {
+          ReportReplications (replication, jobs, outputPrefix + ".replications" +
+                              (format == LoraTableWriter::BINARY ? ".bin" : ".txt"),
+                              format);
+        }
+    }
+  return point;
+}
+
+// Apply the parameters of the point a child of the sweep runs, in which the
+// run of its replication takes the place of runSeed. The seed and the run
+// are read back from RngSeedManager, as after the command line.
+void
+SetSweepPoint (CommandLine &cmd, char *program, const LoraSweepRunner::Job &point,
+               bool replicate, uint32_t replicationRun, int &seed, uint32_t &runSeed)
+{
+  ParsePoint (cmd, program, point);
+  if (replicate)
+    {
+      runSeed = replicationRun;
+    }
+  RngSeedManager::SetRun (runSeed);
+  seed = RngSeedManager::GetSeed ();
+  runSeed = RngSeedManager::GetRun ();
+}
+
+// Look the run up in the result cache. On a hit, its row is set, and
+// reported to the replications with replicate, and its device table is
+// written: the run only has to commit the row.
+bool
+LookupCachedRow (const std::string &cacheDir, const std::string &config,
+                 const std::vector<std::string> &columns,
+                 const std::vector<std::string> &phases, uint32_t runSeed,
+                 bool replicate, LoraReplicationRunner &replication,
+                 LoraResultsSink &results, const std::string &devicesName,
+                 LoraTableWriter::Format format)
+{
+  std::vector<double> row;
+  if (!LoraResultCache (cacheDir).Lookup (config, row) || row.size () != columns.size ())
+    {
+      return false;
+    }
+  std::cout << "Result cache hit, RunSeed: " << runSeed << std::endl;
+  if (replicate)
+    {
+      replication.Report (GetReplicationMetrics (columns, row));
+    }
+  SetCachedRow (results, columns, phases, row);
+  RestoreDeviceTable (cacheDir, config, devicesName, format);
+  return true;
+}
+
+// Place a grid of buildings over the area, if the channel model is the
+// realistic one, and print them with print
+void
+CreateBuildings (int radius, bool realisticChannelModel, bool print,
+                 NodeContainer endDevices, NodeContainer gateways)
+{
+  double xLength = 130;
+  double deltaX = 32;
+  double yLength = 64;
+  double deltaY = 17;
+  int gridWidth = 2 * radius / (xLength + deltaX);
+  int gridHeight = 2 * radius / (yLength + deltaY);
+  if (realisticChannelModel == false)
+    {
+      gridWidth = 0;
+      gridHeight = 0;
+    }
+  Ptr<GridBuildingAllocator> gridBuildingAllocator;
+  gridBuildingAllocator = CreateObject<GridBuildingAllocator> ();
+  gridBuildingAllocator->SetAttribute ("GridWidth", UintegerValue (gridWidth));
+  gridBuildingAllocator->SetAttribute ("LengthX", DoubleValue (xLength));
+  gridBuildingAllocator->SetAttribute ("LengthY", DoubleValue (yLength));
+  gridBuildingAllocator->SetAttribute ("DeltaX", DoubleValue (deltaX));
+  gridBuildingAllocator->SetAttribute ("DeltaY", DoubleValue (deltaY));
+  gridBuildingAllocator->SetAttribute ("Height", DoubleValue (6));
+  gridBuildingAllocator->SetBuildingAttribute ("NRoomsX", UintegerValue (2));
+  gridBuildingAllocator->SetBuildingAttribute ("NRoomsY", UintegerValue (4));
+  gridBuildingAllocator->SetBuildingAttribute ("NFloors", UintegerValue (2));
+  gridBuildingAllocator->SetAttribute ("MinX", DoubleValue (-gridWidth * (xLength + deltaX) / 2 + deltaX / 2));
+  gridBuildingAllocator->SetAttribute ("MinY", DoubleValue (-gridHeight * (yLength + deltaY) / 2 + deltaY / 2));
+  BuildingContainer bContainer = gridBuildingAllocator->Create (gridWidth * gridHeight);
+
+  BuildingsHelper::Install (endDevices);
+  BuildingsHelper::Install (gateways);
+  BuildingsHelper::MakeMobilityModelConsistent ();
+
+  // Print the buildings
+  if (print)
+    {
+      std::vector<std::string> columns;
+      columns.push_back ("Building");
+      columns.push_back ("xMin");
+      columns.push_back ("yMin");
+      columns.push_back ("xMax");
+      columns.push_back ("yMax");
+      std::remove ("buildings.txt");
+      LoraTableWriter table ("buildings.txt", columns, LoraTableWriter::TEXT);
+      std::vector<Ptr<Building> >::const_iterator it;
+      int j = 1;
+      for (it = bContainer.Begin (); it != bContainer.End (); ++it, ++j)
+        {
+          Box boundaries = (*it)->GetBoundaries ();
+          table.Add (j);
+          table.Add (boundaries.xMin);
+          table.Add (boundaries.yMin);
+          table.Add (boundaries.xMax);
+          table.Add (boundaries.yMax);
+        }
+      table.Close ();
+
+    }
 }
 
 
 int main (int argc, char *argv[])
 {
-	tic();
+  tic ();
   // Set up logging
   LogComponentEnable ("LoraEnergyModelExample", LOG_LEVEL_ALL);
 //  LogComponentEnable ("LoraRadioEnergyModel", LOG_LEVEL_ALL);
@@ -162,123 +596,306 @@ int main (int argc, char *argv[])
   int txPowerdBm = 12;
   int hours = 2;
   double distanceReference = 8.1;
-
-	if (fixedSeed){
-		RngSeedManager::SetSeed(seed);
-		RngSeedManager::SetRun(runSeed);
-	}
-
-	//Getting seed and runSeed for checking and displaying purposes
-	seed = RngSeedManager::GetSeed();
-	runSeed = RngSeedManager::GetRun();
+  bool aggregation = false;
+  bool fleetSender = false;
+  bool adr = false;
+  std::string sweep;
+  std::string sweepFile;
+  uint32_t sweepWorkers = 0;
+  bool forkAfterSetup = false;
+  bool binaryResults = false;
+  std::string cacheDir;
+  double ciTarget = 0;
+  double ciConfidence = 0.95;
+  uint32_t minRuns = 5;
+  uint32_t maxRuns = 30;
+  double progress = 0;
+  std::string progressFile;
+  double checkpointHours = 0;
+  bool resume = false;
+  std::string topologyCache;
+  double maxAggregationDelay = 600;
+
+  if (fixedSeed)
+    {
+      RngSeedManager::SetSeed (seed);
+      RngSeedManager::SetRun (runSeed);
+    }
+
+  //Getting seed and runSeed for checking and displaying purposes
+  seed = RngSeedManager::GetSeed ();
+  runSeed = RngSeedManager::GetRun ();
+  uint32_t defaultRunSeed = runSeed;
 
   std::string outputDir = "./";
   std::string filename = "DadosBattery";
   std::string chFilename;
+  std::string resultsName;
+  std::string devicesName;
+  std::string pointDir;
+
+
+
+  CommandLine cmd;
+  cmd.AddValue ("nDevices",
+                "Number of end devices to include in the simulation",
+                nDevices);
+  cmd.AddValue ("radius",
+                "The radius of the area to simulate",
+                radius);
+  cmd.AddValue ("appPeriodsSeconds",
+                "The period in seconds to be used by periodically transmitting applications",
+                appPeriodsSeconds);
+  cmd.AddValue ("outputDir",
+                "Output directory",
+                outputDir);
+  cmd.AddValue ("filename",
+                "Output file name",
+                filename);
+  cmd.AddValue ("algoritmo",
+                "Algoritmo de alocaçao de SF a ser utilizado",
+                algoritmo);
+  cmd.AddValue ("packetsize",
+                "Tamanho do pacote em bytes",
+                packetsize);
+  cmd.AddValue ("runSeed",
+                "Set runseed",
+                runSeed);
+  cmd.AddValue ("expoenteN",
+                "expoente N da regressão para modelo los ou nlos",
+                N);
+  cmd.AddValue ("distanceReference",
+                " distancia de referencia de regressão para modelo los ou nlos",
+                distanceReference);
+  cmd.AddValue ("sigma",
+                "Desvio padrão do PL em dB",
+                sigma);
+  cmd.AddValue ("txPowerdBm",
+                "Potência de transmissão em dBm",
+                txPowerdBm);
+  cmd.AddValue ("hours",
+                "Tempo de simulação em horas",
+                hours);
+  cmd.AddValue ("aggregation",
+                "Agrega os payloads da aplicação em um único frame",
+                aggregation);
+  cmd.AddValue ("maxAggregationDelay",
+                "Tempo máximo de espera de um payload para agregação, em segundos",
+                maxAggregationDelay);
+  cmd.AddValue ("fleetSender",
+                "Gera o tráfego de todos os dispositivos com um único FleetPeriodicSender",
+                fleetSender);
+  cmd.AddValue ("adr",
+                "Instala um network server com ADR que minimiza a energia por uplink",
+                adr);
+  cmd.AddValue ("sweep",
+                "Grade de parâmetros a simular em paralelo, ex. \"runSeed=1:10;txPowerdBm=2,8,14\"",
+                sweep);
+  cmd.AddValue ("sweepFile",
+                "Arquivo com um ponto da varredura por linha, ex. \"nDevices=100 sigma=4\"",
+                sweepFile);
+  cmd.AddValue ("sweepWorkers",
+                "Número de processos da varredura (0 = um por núcleo)",
+                sweepWorkers);
+  cmd.AddValue ("forkAfterSetup",
+                "Monta o cenário uma vez e cria um processo por ponto da varredura "
+                "(só runSeed, txPowerdBm, appPeriodsSeconds e hours podem variar)",
+                forkAfterSetup);
+  cmd.AddValue ("binaryResults",
+                "Grava os resultados em formato binário (filename.bin) em vez de texto",
+                binaryResults);
+  cmd.AddValue ("cacheDir",
+                "Diretório do cache de resultados: pontos já simulados não são simulados de novo",
+                cacheDir);
+  cmd.AddValue ("ciTarget",
+                "Repete cada ponto da varredura com runSeeds diferentes até a meia largura do "
+                "intervalo de confiança de batteryEnergyFinal e do PDR ficar abaixo desta "
+                "fração da média (0 = um run por ponto)",
+                ciTarget);
+  cmd.AddValue ("ciConfidence",
+                "Nível de confiança dos intervalos",
+                ciConfidence);
+  cmd.AddValue ("minRuns",
+                "Número mínimo de runs por ponto com ciTarget",
+                minRuns);
+  cmd.AddValue ("maxRuns",
+                "Número máximo de runs por ponto com ciTarget",
+                maxRuns);
+  cmd.AddValue ("progress",
+                "Intervalo em segundos de tempo real entre relatórios de progresso "
+                "(0 = sem relatórios)",
+                progress);
+  cmd.AddValue ("progressFile",
+                "Arquivo de estado com o progresso, reescrito a cada relatório, em vez "
+                "de stderr (numa varredura, com o pid do processo no fim do nome)",
+                progressFile);
+  cmd.AddValue ("checkpointHours",
+                "Intervalo em horas simuladas entre checkpoints dos dispositivos "
+                "(0 = sem checkpoints, requer fleetSender)",
+                checkpointHours);
+  cmd.AddValue ("resume",
+                "Retoma a simulação do último checkpoint desta configuração, se houver",
+                resume);
+  cmd.AddValue ("topologyCache",
+                "Diretório do cache de topologia (posições, perdas dos enlaces e SF/potência "
+                "de cada cenário)",
+                topologyCache);
+  cmd.Parse (argc, argv);
+
+  // runSeed is the run of the simulation, and --RngRun only sets it when
+  // runSeed is not given. Both are then read back from RngSeedManager, so
+  // that the cache keys name the streams the run really draws from.
+  if (runSeed == defaultRunSeed)
+    {
+      runSeed = RngSeedManager::GetRun ();
+    }
+  RngSeedManager::SetRun (runSeed);
+  seed = RngSeedManager::GetSeed ();
+  runSeed = RngSeedManager::GetRun ();
 
+  /*********************
+   *  Parameter sweep  *
+   *********************/
 
-
-	CommandLine cmd;
-	cmd.AddValue ("nDevices",
-			"Number of end devices to include in the simulation",
-			nDevices);
-	cmd.AddValue ("radius",
-			"The radius of the area to simulate",
-			radius);
-	cmd.AddValue ("appPeriodsSeconds",
-			"The period in seconds to be used by periodically transmitting applications",
-			appPeriodsSeconds);
-	cmd.AddValue ("outputDir",
-				"Output directory",
-				outputDir);
-	cmd.AddValue ("filename",
-					"Output file name",
-					filename);
-	cmd.AddValue ("algoritmo",
-			"Algoritmo de alocaçao de SF a ser utilizado",
-			algoritmo);
-	cmd.AddValue ("packetsize",
-				"Tamanho do pacote em bytes",
-				packetsize);
-	cmd.AddValue ("runSeed",
-				"Set runseed",
-				runSeed);
-	cmd.AddValue ("expoenteN",
-				  "expoente N da regressão para modelo los ou nlos",
-				  N);
-	cmd.AddValue ("distanceReference",
-				 " distancia de referencia de regressão para modelo los ou nlos",
-				  distanceReference);
-	cmd.AddValue ("sigma",
-				  "Desvio padrão do PL em dB",
-				  sigma);
-	cmd.AddValue ("txPowerdBm",
-				  "Potência de transmissão em dBm",
-				  txPowerdBm);
-	cmd.AddValue ("hours",
-				  "Tempo de simulação em horas",
-				  hours);
-	cmd.Parse (argc, argv);
-
-
-
-// Displaying the seed and runSeed being used in the simulation
-	std::cout << "Seed: " << seed << ", RunSeed: " << runSeed << std::endl;
-
-  chFilename = outputDir+"/"+ filename+".txt";
-  std::ifstream file(chFilename.c_str());
-  bool firstTime = is_empty(file);
-
-  file.close();
-  std::ofstream myfile;
-
-
-  myfile.open(chFilename.c_str(), std::ofstream::app);
-  if ( firstTime )
-  	{
-  		// file is empty: write down the header
-  		myfile <<
-//  				"Amplificador," <<
-  				"RunSeed," <<
-				"Seed," <<
-				"packetSize," <<
-				"N," <<
-				"d," <<
-				"sigma," <<
-  				"Algoritmo," <<
-  				"Radius," <<
-  				"nDevices," <<
-  				"appPeriodsSeconds," <<
-				"batteryVoltage," <<
-				"batteryEnergyInit," <<
-				"hours," <<
-				"TxPowerdBm," <<
-				"PHYTotal," <<
-				"PHYSuccessful," <<
-				"PHYInterfered," <<
-				"PHYNoMoreReceivers," <<
-				"PHYUnderSensitivity," <<
-				"PHYLostBecauseTX," <<
-				"batteryEnergyFinal";
-  	}
-
-  	myfile << std::endl <<
-  			runSeed << "," <<
-			seed << "," <<
-  			packetsize << "," <<
-			N << "," <<
-			distanceReference << "," <<
-			sigma << "," <<
-  			algoritmo << "," <<
-  			radius<< "," <<
-  			nDevices << "," <<
-  			appPeriodsSeconds << "," <<
-  			batteryVoltage << "," <<
-			batteryEnergyInit << "," <<
-			hours << "," <<
-  			txPowerdBm << ",";
-
-  	myfile.close ();
+  std::vector<LoraSweepRunner::Job> jobs = GetSweepJobs (sweep, sweepFile, nDevices, hours,
+                                                         appPeriodsSeconds, ciTarget);
+
+  // With ciTarget, the points of the sweep are configurations, each run
+  // with runSeed, runSeed + 1, ... until their intervals are narrow enough
+  bool replicate = ciTarget > 0 && !jobs.empty ();
+  LoraReplicationRunner replication (sweepWorkers, 2);
+  replication.SetTarget (ciTarget, ciConfidence);
+  replication.SetRuns (minRuns, maxRuns, runSeed);
+  uint32_t replicationRun = runSeed;
+  uint32_t nFailed = 0;
+
+  // Without forkAfterSetup, every point builds its own scenario
+  if (!jobs.empty () && !forkAfterSetup)
+    {
+      int point = RunSweep (jobs, sweepWorkers, replicate, replication, replicationRun,
+                            "points", outputDir + "/" + filename,
+                            outputDir + "/" + filename + (binaryResults ? ".bin" : ".txt"),
+                            binaryResults ? LoraTableWriter::BINARY : LoraTableWriter::TEXT,
+                            nFailed);
+      if (point < 0)
+        {
+          return nFailed ? 1 : 0;
+        }
+
+      // This process runs a single point. Its row goes to the same results
+      // file as the others: see LoraResultsSink.
+      SetSweepPoint (cmd, argv[0], jobs[point], replicate, replicationRun, seed, runSeed);
+    }
+
+  Config::SetDefault ("ns3::EndDeviceLoraMac::Aggregation",
+                      BooleanValue (aggregation));
+  Config::SetDefault ("ns3::EndDeviceLoraMac::MaxAggregationDelay",
+                      TimeValue (Seconds (maxAggregationDelay)));
+  Config::SetDefault ("ns3::EndDeviceLoraMac::ADR", BooleanValue (adr));
+
+
+
+  // The whole row of the run is written at the end, at once, and so is
+  // the table of the devices
+  std::string outputPrefix = GetAbsolutePath (outputDir + "/" + filename);
+  progressFile = GetAbsolutePath (progressFile);
+  resultsName = outputPrefix + (binaryResults ? ".bin" : ".txt");
+  devicesName = outputPrefix + ".devices" + (binaryResults ? ".bin" : ".txt");
+
+  // Fixed schema of the results: the parameters of the run, the counts of
+  // the packet tracker and the remaining energy
+  std::vector<std::string> columns;
+  columns.push_back ("RunSeed");
+  columns.push_back ("Seed");
+  columns.push_back ("packetSize");
+  columns.push_back ("N");
+  columns.push_back ("d");
+  columns.push_back ("sigma");
+  columns.push_back ("Algoritmo");
+  columns.push_back ("Radius");
+  columns.push_back ("nDevices");
+  columns.push_back ("appPeriodsSeconds");
+  columns.push_back ("batteryVoltage");
+  columns.push_back ("batteryEnergyInit");
+  columns.push_back ("hours");
+  columns.push_back ("TxPowerdBm");
+  columns.push_back ("PHYTotal");
+  columns.push_back ("PHYSuccessful");
+  columns.push_back ("PHYInterfered");
+  columns.push_back ("PHYNoMoreReceivers");
+  columns.push_back ("PHYUnderSensitivity");
+  columns.push_back ("PHYLostBecauseTX");
+  columns.push_back ("batteryEnergyFinal");
+  // Time of the checkpoint a resumed run started from, whose PHY columns
+  // only cover what came after it. Empty for a run from the start.
+  columns.push_back ("ResumedAtHours");
+
+  // Cost of each phase of the script, to catch performance regressions in
+  // the same data
+  LoraPhaseProfiler profiler;
+  std::vector<std::string> phases = {"channel", "devices", "buildings", "sf", "apps",
+                                     "energy", "run", "output", "performance"};
+  for (std::size_t i = 0; i < phases.size (); i++)
+    {
+      columns.push_back (phases[i] + "Seconds");
+      columns.push_back (phases[i] + "Events");
+      columns.push_back (phases[i] + "PeakRssMB");
+    }
+  columns.push_back ("runEventsPerSecond");
+  LoraTableWriter::Format tableFormat = binaryResults ? LoraTableWriter::BINARY :
+    LoraTableWriter::TEXT;
+  LoraResultsSink results (columns, tableFormat);
+
+  // Everything the row depends on, this build of the code included. With
+  // forkAfterSetup, the scenario is built with the parameters given before
+  // the sweep, so they are part of the configuration too.
+  std::string setupConfig;
+  auto makeConfig = [&] ()
+    {
+      std::ostringstream config;
+      config.precision (17);
+      config << "build=" << LoraResultCache::GetBuildId () <<
+        ";seed=" << seed << ";runSeed=" << runSeed <<
+        ";nDevices=" << nDevices << ";radius=" << radius <<
+        ";appPeriodsSeconds=" << appPeriodsSeconds << ";algoritmo=" << algoritmo <<
+        ";packetsize=" << packetsize << ";expoenteN=" << N <<
+        ";distanceReference=" << distanceReference << ";sigma=" << sigma <<
+        ";txPowerdBm=" << txPowerdBm << ";hours=" << hours <<
+        ";aggregation=" << aggregation << ";maxAggregationDelay=" << maxAggregationDelay <<
+        ";fleetSender=" << fleetSender << ";adr=" << adr <<
+        ";forkAfterSetup=" << forkAfterSetup <<
+        ";realisticChannelModel=" << realisticChannelModel <<
+        ";batteryVoltage=" << batteryVoltage << ";batteryEnergyInit=" << batteryEnergyInit <<
+        ";setup=" << setupConfig;
+      return config.str ();
+    };
+  if (forkAfterSetup)
+    {
+      setupConfig = makeConfig ();
+    }
+
+  // A run that is in the cache only writes its row and its device table
+  if (!cacheDir.empty () && !(forkAfterSetup && !jobs.empty ())
+      && LookupCachedRow (cacheDir, makeConfig (), columns, phases, runSeed,
+                          replicate, replication, results, devicesName, tableFormat))
+    {
+      return results.Commit (resultsName) ? 0 : 1;
+    }
+
+  // The packet tracker writes the PHY columns to a file of its own, which
+  // is read back into the row. With forkAfterSetup, each point runs in its
+  // own directory: see below.
+  if (forkAfterSetup)
+    {
+      chFilename = filename + ".phy.txt";
+    }
+  else
+    {
+      std::ostringstream phyFilename;
+      phyFilename << outputDir << "/" << filename << ".phy" << getpid () << ".txt";
+      chFilename = phyFilename.str ();
+    }
+  std::remove (chFilename.c_str ());
 
 
 
@@ -287,6 +904,7 @@ int main (int argc, char *argv[])
   ************************/
 
   NS_LOG_INFO ("Creating the channel...");
+  profiler.Start ("channel");
 
 
   Ptr<NormalRandomVariable> gaussianVar = CreateObject<NormalRandomVariable> ();
@@ -311,21 +929,34 @@ int main (int argc, char *argv[])
   NS_LOG_INFO("Gaussian na classe  " << loss->GetGaussianVariable() << " gaussiano");
 
   if (realisticChannelModel)
-  	{
-  		// Create the correlated shadowing component
-  		Ptr<CorrelatedShadowingPropagationLossModel> shadowing = CreateObject<CorrelatedShadowingPropagationLossModel> ();
+    {
+      // Create the correlated shadowing component
+      Ptr<CorrelatedShadowingPropagationLossModel> shadowing = CreateObject<CorrelatedShadowingPropagationLossModel> ();
 
-  		// Aggregate shadowing to the logdistance loss
-  		loss->SetNext (shadowing);
+      // Aggregate shadowing to the logdistance loss
+      loss->SetNext (shadowing);
 
-  		// Add the effect to the channel propagation loss
-  		Ptr<BuildingPenetrationLoss> buildingLoss = CreateObject<BuildingPenetrationLoss> ();
+      // Add the effect to the channel propagation loss
+      Ptr<BuildingPenetrationLoss> buildingLoss = CreateObject<BuildingPenetrationLoss> ();
 
-  		shadowing->SetNext (buildingLoss);
-  	}
+      shadowing->SetNext (buildingLoss);
+    }
   Ptr<PropagationDelayModel> delay = CreateObject<ConstantSpeedPropagationDelayModel> ();
 
-  Ptr<LoraChannel> channel = CreateObject<LoraChannel> (loss, delay);
+  // With a topology cache, the channel reads the links between the end
+  // devices and the gateways from the cache (see the sf phase)
+  Ptr<CachedPropagationLossModel> cachedLoss;
+  Ptr<LoraChannel> channel;
+  if (topologyCache.empty ())
+    {
+      channel = CreateObject<LoraChannel> (loss, delay);
+    }
+  else
+    {
+      cachedLoss = CreateObject<CachedPropagationLossModel> ();
+      cachedLoss->SetModel (loss);
+      channel = CreateObject<LoraChannel> (cachedLoss, delay);
+    }
 
   /************************
   *  Create the helpers  *
@@ -335,9 +966,9 @@ int main (int argc, char *argv[])
 
   MobilityHelper mobility;
   mobility.SetPositionAllocator ("ns3::UniformDiscPositionAllocator",
-  			"rho", DoubleValue (radius),
-  			"X", DoubleValue (0.0),
-  			"Y", DoubleValue (0.0));
+                                 "rho", DoubleValue (radius),
+                                 "X", DoubleValue (0.0),
+                                 "Y", DoubleValue (0.0));
   mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
 //  Ptr<ListPositionAllocator> allocator = CreateObject<ListPositionAllocator> ();
 //  allocator->Add (Vector (1000,0,0));
@@ -361,11 +992,41 @@ int main (int argc, char *argv[])
   ************************/
 
   NS_LOG_INFO ("Creating the end device...");
+  profiler.Start ("devices");
 
   // Create a set of nodes
+  uint64_t residentBytesBeforeDevices = GetResidentBytes ();
   NodeContainer endDevices;
   endDevices.Create (nDevices);
 
+  // The positions, the link budget and the spreading factors of a scenario
+  // only depend on these parameters: they are computed by the first run and
+  // read back by the next ones
+  bool topologyHit = false;
+  Ptr<LoraTopologyCache> topology;
+  if (!topologyCache.empty ())
+    {
+      std::ostringstream config;
+      config.precision (17);
+      config << "build=" << LoraResultCache::GetBuildId () <<
+        ";seed=" << seed << ";runSeed=" << runSeed <<
+        ";nDevices=" << nDevices << ";radius=" << radius << ";algoritmo=" << algoritmo <<
+        ";expoenteN=" << N << ";distanceReference=" << distanceReference << ";sigma=" << sigma <<
+        ";realisticChannelModel=" << realisticChannelModel;
+      topology = Create<LoraTopologyCache> (topologyCache, config.str ());
+      topologyHit = topology->Open () && topology->GetNDevices () == uint32_t (nDevices);
+      if (topologyHit)
+        {
+          // The positions are read instead of drawn
+          Ptr<ListPositionAllocator> positions = CreateObject<ListPositionAllocator> ();
+          for (int i = 0; i < nDevices; i++)
+            {
+              positions->Add (topology->GetPosition (i));
+            }
+          mobility.SetPositionAllocator (positions);
+        }
+    }
+
   // Assign a mobility model to the node
   mobility.Install (endDevices);
 
@@ -386,7 +1047,7 @@ int main (int argc, char *argv[])
   gateways.Create (1);
 
   Ptr<ListPositionAllocator> allocator = CreateObject<ListPositionAllocator> ();//ADRcode
-  	// Make it so that nodes are at a certain height > 0 //ADRcode
+  // Make it so that nodes are at a certain height > 0 //ADRcode
   allocator->Add (Vector (0.0, 0.0, 15.0)); //ADRcode
 
   mobility.SetPositionAllocator (allocator);
@@ -398,92 +1059,96 @@ int main (int argc, char *argv[])
   helper.Install (phyHelper, macHelper, gateways);
 
 
-	/**********************
-	 *  Handle buildings  *
-	 **********************/
-
-	double xLength = 130;
-	double deltaX = 32;
-	double yLength = 64;
-	double deltaY = 17;
-	int gridWidth = 2 * radius / (xLength + deltaX);
-	int gridHeight = 2 * radius / (yLength + deltaY);
-	if (realisticChannelModel == false)
-	{
-		gridWidth = 0;
-		gridHeight = 0;
-	}
-	Ptr<GridBuildingAllocator> gridBuildingAllocator;
-	gridBuildingAllocator = CreateObject<GridBuildingAllocator> ();
-	gridBuildingAllocator->SetAttribute ("GridWidth", UintegerValue (gridWidth));
-	gridBuildingAllocator->SetAttribute ("LengthX", DoubleValue (xLength));
-	gridBuildingAllocator->SetAttribute ("LengthY", DoubleValue (yLength));
-	gridBuildingAllocator->SetAttribute ("DeltaX", DoubleValue (deltaX));
-	gridBuildingAllocator->SetAttribute ("DeltaY", DoubleValue (deltaY));
-	gridBuildingAllocator->SetAttribute ("Height", DoubleValue (6));
-	gridBuildingAllocator->SetBuildingAttribute ("NRoomsX", UintegerValue (2));
-	gridBuildingAllocator->SetBuildingAttribute ("NRoomsY", UintegerValue (4));
-	gridBuildingAllocator->SetBuildingAttribute ("NFloors", UintegerValue (2));
-	gridBuildingAllocator->SetAttribute ("MinX", DoubleValue (-gridWidth * (xLength + deltaX) / 2 + deltaX / 2));
-	gridBuildingAllocator->SetAttribute ("MinY", DoubleValue (-gridHeight * (yLength + deltaY) / 2 + deltaY / 2));
-	BuildingContainer bContainer = gridBuildingAllocator->Create (gridWidth * gridHeight);
-
-	BuildingsHelper::Install (endDevices);
-	BuildingsHelper::Install (gateways);
-	BuildingsHelper::MakeMobilityModelConsistent ();
-
-	// Print the buildings
-	if (print)
-	{
-		std::ofstream myfile;
-		myfile.open ("buildings.txt");
-		std::vector<Ptr<Building> >::const_iterator it;
-		int j = 1;
-		for (it = bContainer.Begin (); it != bContainer.End (); ++it, ++j)
-		{
-			Box boundaries = (*it)->GetBoundaries ();
-			myfile << "set object " << j << " rect from " << boundaries.xMin << "," << boundaries.yMin << " to " << boundaries.xMax << "," << boundaries.yMax << std::endl;
-		}
-		myfile.close ();
-
-	}
-
-
-  macHelper.SetSpreadingFactorsUp (endDevices, gateways, channel, algoritmo);
-
-  for (uint32_t i = 0; i < endDevices.GetN(); ++i) {
-      Ptr<Node> node = endDevices.Get(i);
-      for (uint32_t j = 0; j < node->GetNDevices(); ++j) {
-          Ptr<LoraNetDevice> loraNetDevice = DynamicCast<LoraNetDevice>(node->GetDevice(j));
-
-          if (loraNetDevice) {
-              Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac()->GetObject<EndDeviceLoraMac>();
-              if (mac) {
-                  mac->SetTransmissionPower(txPowerdBm);
-                  std::cout << "Potencia de transmissao para o dispositivo" << i << ": " << txPowerdBm << " dBm\n";
-
-              } else {
-            	  std::cerr << "Erro: MAC nao encontrado para o dispositivo " << i << "\n";
-                  }
-          }
-      }
-  }
-
+  /**********************
+   *  Handle buildings  *
+   **********************/
+
+  profiler.Start ("buildings");
+  CreateBuildings (radius, realisticChannelModel, print, endDevices, gateways);
+
+
+  profiler.Start ("sf");
+
+  // Without a cached topology, compute the link budget before the spreading
+  // factor assignment, which reads it through the channel
+  if (topology)
+    {
+      if (!topologyHit)
+        {
+          topology->Build (endDevices, gateways, loss);
+        }
+      cachedLoss->SetCache (topology, endDevices, gateways);
+    }
+  if (topologyHit)
+    {
+      topology->Apply (endDevices);
+    }
+  else
+    {
+      macHelper.SetSpreadingFactorsUp (endDevices, gateways, channel, algoritmo);
+      if (topology)
+        {
+          topology->Store (endDevices);
+        }
+    }
+
+  // Compute the on-air time of every packet the end devices can send before
+  // the simulation starts (255 bytes is the largest LoRa PHY payload)
+  LoraOnAirTimeCache::Populate (GetLoraRegionProfile (EU868), 255, 8);
 
   /*********************************************
    *  Install applications on the end devices  *
    *********************************************/
 
-  PeriodicSenderHelper periodicSenderHelper;
-  periodicSenderHelper.SetPeriod (Seconds (appPeriodsSeconds));
-    periodicSenderHelper.SetPacketSize (packetsize);
-
-  periodicSenderHelper.Install (endDevices);
+  profiler.Start ("apps");
+
+  Ptr<FleetPeriodicSender> fleetPeriodicSender;
+  ApplicationContainer periodicSenderApps;
+  if (fleetSender)
+    {
+      // One calendar event for the whole fleet instead of one application
+      // per device
+      fleetPeriodicSender = CreateObject<FleetPeriodicSender> ();
+      fleetPeriodicSender->SetPacketSize (packetsize);
+      fleetPeriodicSender->Install (endDevices);
+    }
+  else
+    {
+      PeriodicSenderHelper periodicSenderHelper;
+      periodicSenderHelper.SetPeriod (Seconds (appPeriodsSeconds));
+      periodicSenderHelper.SetPacketSize (packetsize);
+
+      periodicSenderApps = periodicSenderHelper.Install (endDevices);
+    }
+
+  /***************************
+   *  Create Network Server  *
+   ***************************/
+
+  if (adr)
+    {
+      // The network server sets the data rate and power of the devices with
+      // the EnergyAwareAdrComponent
+      NodeContainer networkServers;
+      networkServers.Create (1);
+
+      NetworkServerHelper networkServerHelper;
+      networkServerHelper.SetGateways (gateways);
+      networkServerHelper.SetEndDevices (endDevices);
+      networkServerHelper.EnableAdr (true);
+      networkServerHelper.SetAdr ("ns3::EnergyAwareAdrComponent");
+      networkServerHelper.Install (networkServers);
+
+      ForwarderHelper forwarderHelper;
+      forwarderHelper.Install (gateways);
+    }
 
   /************************
    * Install Energy Model *
    ************************/
 
+  profiler.Start ("energy");
+
   BasicEnergySourceHelper basicSourceHelper;
   LoraRadioEnergyModelHelper radioEnergyHelper;
 
@@ -505,8 +1170,9 @@ int main (int argc, char *argv[])
 //  radioEnergyHelper.Set ("RxCurrentA", DoubleValue (0.0112));
 //  radioEnergyHelper.Set ("IdleCurrentA", DoubleValue (0.00015));
   radioEnergyHelper.SetTxCurrentModel ("ns3::SX1272LoRaWANCurrentModel",
-		  	  	  	  	  	  	  	   "TxPowerToTxCurrent", DoubleValue(txPowerdBm),
-								       "UsePaBoost", BooleanValue(true));
+                                       "TxPowerToTxCurrent", DoubleValue(txPowerdBm),
+                                       "UsePaBoost", BooleanValue(true),
+                                       "TrackTxPower", BooleanValue(adr));
 
 
   // install source on EDs' nodes
@@ -516,6 +1182,169 @@ int main (int argc, char *argv[])
   DeviceEnergyModelContainer deviceModels = radioEnergyHelper.Install
       (endDevicesNetDevices, sources);
 
+  // Memory footprint of an end device: object sizes, and the growth of the
+  // resident set while creating the devices (which also includes the
+  // gateway, the buildings and the applications)
+  NS_LOG_INFO ("Bytes per device: EndDeviceLoraMac " << sizeof (EndDeviceLoraMac) <<
+               ", EndDeviceLoraPhy " << sizeof (EndDeviceLoraPhy) <<
+               ", LoraNetDevice " << sizeof (LoraNetDevice) <<
+               ", LoraRadioEnergyModel " << sizeof (LoraRadioEnergyModel) <<
+               ", BasicEnergySource " << sizeof (BasicEnergySource) <<
+               ", resident set " <<
+               (nDevices ? (GetResidentBytes () - residentBytesBeforeDevices) / nDevices : 0));
+  profiler.Stop ();
+
+  /***********************
+   *  Fork after setup   *
+   ***********************/
+
+  // The scenario is built: each point of the sweep gets a copy-on-write
+  // copy of it, in which only the run-phase parameters change
+  if (forkAfterSetup && !jobs.empty ())
+    {
+      CheckForkedJobs (jobs);
+      int point = RunSweep (jobs, sweepWorkers, replicate, replication, replicationRun,
+                            "points forked after setup", outputPrefix, resultsName,
+                            tableFormat, nFailed);
+      if (point < 0)
+        {
+          return nFailed ? 1 : 0;
+        }
+
+      // Random variables created during the setup keep their streams. The
+      // counter-based streams of the MAC and the fleet sender follow the
+      // new run.
+      double setupTxPowerdBm = txPowerdBm;
+      SetSweepPoint (cmd, argv[0], jobs[point], replicate, replicationRun, seed, runSeed);
+      LoraCounterRng::SetKey (seed, runSeed);
+
+      if (!cacheDir.empty ()
+          && LookupCachedRow (cacheDir, makeConfig (), columns, phases, runSeed,
+                              replicate, replication, results, devicesName, tableFormat))
+        {
+          return results.Commit (resultsName) ? 0 : 1;
+        }
+
+      // The packet tracker writes to chFilename, relative to the current
+      // directory, so each run gets a directory of its own. The results
+      // file is an absolute path.
+      std::ostringstream runDir;
+      runDir << outputDir << "/" << filename << ".point" << point << ".run" << runSeed;
+      pointDir = runDir.str ();
+      mkdir (pointDir.c_str (), 0755);
+      if (chdir (pointDir.c_str ()) != 0)
+        {
+          NS_FATAL_ERROR ("Cannot enter " << pointDir);
+        }
+
+      if (txPowerdBm != setupTxPowerdBm)
+        {
+          for (uint32_t i = 0; i < deviceModels.GetN (); i++)
+            {
+              PointerValue txCurrentModel;
+              deviceModels.Get (i)->GetAttribute ("TxCurrentModel", txCurrentModel);
+              txCurrentModel.Get<LoraTxCurrentModel> ()->SetAttribute
+                ("TxPowerToTxCurrent", DoubleValue (txPowerdBm));
+            }
+        }
+
+      // The helper drew the first send of each device during the setup,
+      // from the streams of the setup run. Draw it again from the streams
+      // of this run, within its period, so that the points do not share
+      // their start offsets.
+      Ptr<UniformRandomVariable> initialDelay = CreateObject<UniformRandomVariable> ();
+      for (uint32_t i = 0; i < periodicSenderApps.GetN (); i++)
+        {
+          Ptr<PeriodicSender> sender = DynamicCast<PeriodicSender> (periodicSenderApps.Get (i));
+          sender->SetInterval (Seconds (appPeriodsSeconds));
+          sender->SetInitialDelay (Seconds (initialDelay->GetValue (0, appPeriodsSeconds)));
+        }
+    }
+
+  /**************************
+   *  Run-phase parameters  *
+   **************************/
+
+  for (uint32_t i = 0; i < endDevices.GetN (); ++i)
+    {
+      Ptr<Node> node = endDevices.Get (i);
+      for (uint32_t j = 0; j < node->GetNDevices (); ++j)
+        {
+          Ptr<LoraNetDevice> loraNetDevice = DynamicCast<LoraNetDevice> (node->GetDevice (j));
+
+          if (loraNetDevice)
+            {
+              Ptr<EndDeviceLoraMac> mac = loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+              if (mac)
+                {
+                  mac->SetTransmissionPower (txPowerdBm);
+                  std::cout << "Potencia de transmissao para o dispositivo" << i << ": " << txPowerdBm << " dBm\n";
+
+                }
+              else
+                {
+                  std::cerr << "Erro: MAC nao encontrado para o dispositivo " << i << "\n";
+                }
+            }
+        }
+    }
+
+
+  // Checkpoints of the devices, one file per configuration. A resumed run
+  // starts its clock at 0, from the time of the checkpoint, and simulates
+  // what was left.
+  LoraCheckpoint checkpoint;
+  std::string checkpointName;
+  bool resumed = false;
+  if (checkpointHours > 0 || resume)
+    {
+      if (!fleetSender)
+        {
+          NS_FATAL_ERROR ("Checkpoints need fleetSender");
+        }
+      std::ostringstream name;
+      name << outputPrefix << ".checkpoint." << std::hex << LoraResultCache::Hash (makeConfig ());
+      checkpointName = name.str ();
+      fleetPeriodicSender->SetPeriod (Seconds (appPeriodsSeconds));
+      checkpoint.SetDevices (endDevices, sources, deviceModels, fleetPeriodicSender);
+      checkpoint.SetConfig (makeConfig ());
+      resumed = resume && checkpoint.Restore (checkpointName);
+      if (resumed)
+        {
+          std::cout << "Resumed from " << checkpointName << " at " <<
+            checkpoint.GetTimeOffset ().GetHours () << " h" << std::endl;
+        }
+      if (checkpointHours > 0)
+        {
+          checkpoint.Schedule (Hours (checkpointHours), checkpointName);
+        }
+    }
+  Time stopTime = Hours (hours) - checkpoint.GetTimeOffset ();
+
+  if (fleetSender && !resumed)
+    {
+      fleetPeriodicSender->SetPeriod (Seconds (appPeriodsSeconds));
+      fleetPeriodicSender->Start (Seconds (0));
+    }
+
+  // Displaying the seed and runSeed being used in the simulation
+  std::cout << "Seed: " << seed << ", RunSeed: " << runSeed << std::endl;
+
+  results.Set ("RunSeed", runSeed);
+  results.Set ("Seed", seed);
+  results.Set ("packetSize", packetsize);
+  results.Set ("N", N);
+  results.Set ("d", distanceReference);
+  results.Set ("sigma", sigma);
+  results.Set ("Algoritmo", algoritmo);
+  results.Set ("Radius", radius);
+  results.Set ("nDevices", nDevices);
+  results.Set ("appPeriodsSeconds", appPeriodsSeconds);
+  results.Set ("batteryVoltage", batteryVoltage);
+  results.Set ("batteryEnergyInit", batteryEnergyInit);
+  results.Set ("hours", hours);
+  results.Set ("TxPowerdBm", txPowerdBm);
+
   /**************
    * Get output *
    **************/
@@ -530,35 +1359,180 @@ int main (int argc, char *argv[])
   *  Simulation  *
   ****************/
 
-  Simulator::Stop (Hours (hours));
-
-  Simulator::Schedule(Seconds(0), &PrintPositions, endDevices, "pos_inicial.txt", algoritmo); //posição inicial
-//  Simulator::Schedule(Seconds(appPeriodsSeconds), &PrintPositions, endDevices, "pos_final.txt"); //posição final
-
-
+  Simulator::Stop (stopTime);
+
+  Config::ConnectWithoutContext ("/NodeList/*/DeviceList/0/$ns3::LoraNetDevice/Mac/$ns3::EndDeviceLoraMac/TxQueueDelay",
+                                 MakeCallback (&OnTxQueueDelay));
+  Config::ConnectWithoutContext ("/NodeList/*/DeviceList/0/$ns3::LoraNetDevice/Phy/$ns3::EndDeviceLoraPhy/StartSending",
+                                 MakeCallback (&OnStartSending));
+  Config::ConnectWithoutContext ("/NodeList/*/DeviceList/0/$ns3::LoraNetDevice/Mac/$ns3::EndDeviceLoraMac/AggregatedFrame",
+                                 MakeCallback (&OnAggregatedFrame));
+
+
+
+  // Progress of long runs, from a single probe event. In a sweep, each
+  // process has a status file of its own, named after its pid.
+  LoraProgressMonitor progressMonitor (progress);
+  if (progress > 0)
+    {
+      if (!progressFile.empty () && !jobs.empty ())
+        {
+          std::ostringstream statusFile;
+          statusFile << progressFile << "." << getpid ();
+          progressFile = statusFile.str ();
+        }
+      progressMonitor.SetStatusFile (progressFile);
+      progressMonitor.SetEnergy (sources, deviceModels);
+      progressMonitor.Start (stopTime);
+    }
+
+  profiler.Start ("run");
   Simulator::Run ();
+  profiler.Start ("output");
+  if (progress > 0)
+    {
+      progressMonitor.Stop ();
+    }
+  double runSeconds = profiler.GetSeconds ("run");
+
+  NS_LOG_INFO ("Simulator events executed: " << Simulator::GetEventCount () <<
+               ", scheduled by end device MAC timers: " <<
+               EndDeviceLoraMac::GetNTimerEvents ());
+
+  // Traffic generation benchmark. Only measured counts are printed: the
+  // PeriodicSender applications do not count their events.
+  NS_LOG_INFO ("Traffic: " << (fleetSender ? "fleet" : "per-device") <<
+               ", devices: " << nDevices <<
+               (fleetSender ? ", traffic events: " +
+                std::to_string (fleetPeriodicSender->GetNEvents ()) : std::string ()) <<
+               ", MAC timer events pending at the end: " <<
+               EndDeviceLoraMac::GetNPendingTimerEvents () <<
+               ", events executed: " << Simulator::GetEventCount () <<
+               ", run wall time: " << runSeconds << " s");
+
+  // Footprint and cost of the MAC
+  NS_LOG_INFO ("MAC: " << sizeof (EndDeviceLoraMac) << " bytes per device, " <<
+               (framesSent ? runSeconds * 1e6 / framesSent : 0) <<
+               " us of wall time per uplink");
 
   double energy = 0;
-  for(int i=0; i<nDevices; i++){
-	  energy += sources.Get(i)->GetRemainingEnergy();
-//	  NS_LOG_INFO("energia restante do dispositivo " << i << " igual a " << sources.Get(i)->GetRemainingEnergy());
+  for (int i = 0; i < nDevices; i++)
+    {
+      energy += sources.Get (i)->GetRemainingEnergy ();
+//      NS_LOG_INFO ("energia restante do dispositivo " << i << " igual a " << sources.Get (i)->GetRemainingEnergy ());
 
-  }
+    }
   batteryEnergyFinal = energy/nDevices;
 
+  // Lifetime of the devices whose battery ran out
+  uint32_t nDepleted = 0;
+  double depletionTimeSum = 0;
+  for (uint32_t i = 0; i < deviceModels.GetN (); i++)
+    {
+      Ptr<LoraRadioEnergyModel> model =
+        DynamicCast<LoraRadioEnergyModel> (deviceModels.Get (i));
+      if (model && model->IsDepleted ())
+        {
+          nDepleted++;
+          depletionTimeSum += model->GetDepletionTime ().GetSeconds ();
+        }
+    }
+  NS_LOG_INFO (nDepleted << " of " << nDevices << " devices depleted, " <<
+               "mean lifetime: " <<
+               (nDepleted ? depletionTimeSum / nDepleted : 0) << " s");
+
+  // Positions and final state of every device, in one table
+  std::vector<double> deviceRows = GetDeviceRows (endDevices, deviceModels, sources,
+                                                  algoritmo, runSeed, seed,
+                                                  checkpoint.GetTimeOffset ());
+  WriteDeviceTable (devicesName, tableFormat, deviceRows);
+
+  double energyConsumed = batteryEnergyInit * nDevices - energy;
+  NS_LOG_INFO ("Application bytes sent: " << appBytesSent << " in " <<
+               framesSent << " frames (" << aggregatedFrames <<
+               " aggregated), energy per byte: " <<
+               (appBytesSent ? energyConsumed / appBytesSent : 0) << " J");
+
+  // Without the pool, every packet handed out would have been allocated
+  NS_LOG_INFO ("Packet allocations per uplink: " <<
+               (framesSent ? double (LoraPacketPool::GetNAcquired ()) / framesSent : 0) <<
+               " without pooling, " <<
+               (framesSent ? double (LoraPacketPool::GetNAllocated ()) / framesSent : 0) <<
+               " with pooling");
+
+  profiler.Stop ();
   Simulator::Destroy ();
 
   NS_LOG_INFO ("Computing performance metrics...");
+  profiler.Start ("performance");
  int transientPeriods = 0;
   Time appPeriod = Seconds(appPeriodsSeconds);
 
 //  helper.PrintPerformance (transientPeriods * appPeriod, Seconds(appPeriodsSeconds));
   helper.PrintPerformance (transientPeriods * appPeriod, Hours(hours));
 
+  NS_LOG_INFO ("MAC command answers: " << MacCommandPool::GetNServed () <<
+               " sent, " << MacCommandPool::GetNAllocated () << " allocated");
+  NS_LOG_INFO ("On-air time lookups: " << LoraOnAirTimeCache::GetNHits () <<
+               " hits, " << LoraOnAirTimeCache::GetNMisses () << " misses");
+
+  profiler.Stop ();
+  profiler.Print (std::cout);
   toc();
-  myfile.open (chFilename.c_str(), std::ofstream::app);
-  myfile << batteryEnergyFinal;
-  myfile.close ();
+
+  // Move the PHY columns written by the packet tracker into the row
+  {
+    std::ifstream phyFile (chFilename.c_str ());
+    std::stringstream phyColumns;
+    phyColumns << phyFile.rdbuf ();
+    results.SetFromText ("PHYTotal", phyColumns.str ());
+  }
+  std::remove (chFilename.c_str ());
+  if (progress > 0 && !progressFile.empty () && !jobs.empty ())
+    {
+      std::remove (progressFile.c_str ());
+    }
+  if (!pointDir.empty ())
+    {
+      rmdir (pointDir.c_str ());
+    }
+
+  results.Set ("batteryEnergyFinal", batteryEnergyFinal);
+  if (resumed)
+    {
+      results.Set ("ResumedAtHours", checkpoint.GetTimeOffset ().GetHours ());
+    }
+  for (std::size_t i = 0; i < phases.size (); i++)
+    {
+      results.Set (phases[i] + "Seconds", profiler.GetSeconds (phases[i]));
+      results.Set (phases[i] + "Events", profiler.GetNEvents (phases[i]));
+      results.Set (phases[i] + "PeakRssMB",
+                   profiler.GetPeakRssBytes (phases[i]) / (1024.0 * 1024.0));
+    }
+  results.Set ("runEventsPerSecond",
+               runSeconds > 0 ? profiler.GetNEvents ("run") / runSeconds : 0);
+  // The PHY columns of a resumed run only cover the time after the
+  // checkpoint, so its row is not cached. The device table is stored
+  // first: a run that finds the row finds the table too.
+  if (!cacheDir.empty () && !resumed)
+    {
+      LoraResultCache cache (cacheDir);
+      cache.Store (GetDeviceTableConfig (makeConfig ()), deviceRows);
+      cache.Store (makeConfig (), results.GetRow ());
+    }
+  if (replicate)
+    {
+      replication.Report (GetReplicationMetrics (columns, results.GetRow ()));
+    }
+  if (!results.Commit (resultsName))
+    {
+      std::cerr << "Erro: resultados nao gravados em " << resultsName << "\n";
+      return 1;
+    }
+  if (!checkpointName.empty ())
+    {
+      std::remove (checkpointName.c_str ());
+    }
 
   return 0;
 }
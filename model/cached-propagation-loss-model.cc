@@ -0,0 +1,105 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/cached-propagation-loss-model.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("CachedPropagationLossModel");
+
+NS_OBJECT_ENSURE_REGISTERED (CachedPropagationLossModel);
+
+TypeId
+CachedPropagationLossModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CachedPropagationLossModel")
+    .SetParent<PropagationLossModel> ()
+    .SetGroupName ("lorawan")
+    .AddConstructor<CachedPropagationLossModel> ();
+  return tid;
+}
+
+CachedPropagationLossModel::CachedPropagationLossModel ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+CachedPropagationLossModel::~CachedPropagationLossModel ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+CachedPropagationLossModel::SetModel (Ptr<PropagationLossModel> model)
+{
+  m_model = model;
+}
+
+void
+CachedPropagationLossModel::SetCache (Ptr<const LoraTopologyCache> cache,
+                                      NodeContainer endDevices, NodeContainer gateways)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT (endDevices.GetN () == cache->GetNDevices ());
+  NS_ASSERT (gateways.GetN () == cache->GetNGateways ());
+
+  m_cache = cache;
+  m_devices.clear ();
+  m_gateways.clear ();
+  m_devices.reserve (endDevices.GetN ());
+  for (uint32_t i = 0; i < endDevices.GetN (); i++)
+    {
+      m_devices[PeekPointer (endDevices.Get (i)->GetObject<MobilityModel> ())] = i;
+    }
+  for (uint32_t j = 0; j < gateways.GetN (); j++)
+    {
+      m_gateways[PeekPointer (gateways.Get (j)->GetObject<MobilityModel> ())] = j;
+    }
+}
+
+double
+CachedPropagationLossModel::DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a,
+                                           Ptr<MobilityModel> b) const
+{
+  if (m_cache)
+    {
+      // There are few gateways: look them up first
+      std::unordered_map<const MobilityModel *, uint32_t>::const_iterator gateway;
+      std::unordered_map<const MobilityModel *, uint32_t>::const_iterator device;
+      if ((gateway = m_gateways.find (PeekPointer (b))) != m_gateways.end ()
+          && (device = m_devices.find (PeekPointer (a))) != m_devices.end ())
+        {
+          return txPowerDbm - m_cache->GetUplinkLoss (device->second, gateway->second);
+        }
+      if ((gateway = m_gateways.find (PeekPointer (a))) != m_gateways.end ()
+          && (device = m_devices.find (PeekPointer (b))) != m_devices.end ())
+        {
+          return txPowerDbm - m_cache->GetDownlinkLoss (device->second, gateway->second);
+        }
+    }
+  return m_model->CalcRxPower (txPowerDbm, a, b);
+}
+
+int64_t
+CachedPropagationLossModel::DoAssignStreams (int64_t stream)
+{
+  return m_model->AssignStreams (stream);
+}
+
+} // namespace lorawan
+} // namespace ns3
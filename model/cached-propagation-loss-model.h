@@ -0,0 +1,74 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CACHED_PROPAGATION_LOSS_MODEL_H
+#define CACHED_PROPAGATION_LOSS_MODEL_H
+
+#include "ns3/propagation-loss-model.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/lora-topology-cache.h"
+#include <unordered_map>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * A propagation loss model that reads the loss of the links between end
+ * devices and gateways from a LoraTopologyCache, instead of evaluating the
+ * chain of loss models for every packet.
+ *
+ * It wraps the loss model of the channel, which still computes the links
+ * the cache does not hold, such as those between two end devices. It is
+ * given to the LoraChannel in place of the wrapped model, before the cache
+ * exists; until SetCache is called, every link goes to the wrapped model.
+ */
+class CachedPropagationLossModel : public PropagationLossModel
+{
+public:
+  static TypeId GetTypeId (void);
+
+  CachedPropagationLossModel ();
+  virtual ~CachedPropagationLossModel ();
+
+  /**
+   * Set the loss model that computes the links that are not cached.
+   */
+  void SetModel (Ptr<PropagationLossModel> model);
+
+  /**
+   * Read the links between the end devices and the gateways from a cache.
+   *
+   * \param cache The cache, built for these nodes, in the same order.
+   */
+  void SetCache (Ptr<const LoraTopologyCache> cache, NodeContainer endDevices,
+                 NodeContainer gateways);
+
+private:
+  virtual double DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a,
+                                Ptr<MobilityModel> b) const;
+  virtual int64_t DoAssignStreams (int64_t stream);
+
+  Ptr<PropagationLossModel> m_model;
+  Ptr<const LoraTopologyCache> m_cache;
+  std::unordered_map<const MobilityModel *, uint32_t> m_devices;    //!< Index of each device
+  std::unordered_map<const MobilityModel *, uint32_t> m_gateways;   //!< Index of each gateway
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* CACHED_PROPAGATION_LOSS_MODEL_H */
@@ -21,9 +21,17 @@
 
 #include "ns3/end-device-lora-mac.h"
 #include "ns3/end-device-lora-phy.h"
+#include "ns3/lora-on-air-time-cache.h"
+#include "ns3/lora-packet-pool.h"
 #include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+#include "ns3/boolean.h"
+#include "ns3/enum.h"
 #include "ns3/log.h"
+#include "ns3/node.h"
+#include "ns3/energy-source-container.h"
 #include <algorithm>
+#include <cmath>
 
 namespace ns3 {
 namespace lorawan {
@@ -32,12 +40,64 @@ NS_LOG_COMPONENT_DEFINE ("EndDeviceLoraMac");
 
 NS_OBJECT_ENSURE_REGISTERED (EndDeviceLoraMac);
 
+// The interval between when a packet is done sending and when the first
+// and the second receive windows are opened (LoRaWAN defaults, the same in
+// all regions), and the duration of a receive window. They are the same
+// for all devices, so they are not stored per device.
+static const int64_t RECEIVE_DELAY1_MS = 1000;
+static const int64_t RECEIVE_DELAY2_MS = 2000;
+static const int64_t RECEIVE_WINDOW_DURATION_MS = 10;
+
+// The second receive window is armed when the first one closes, which
+// happens RECEIVE_DELAY1 + RECEIVE_WINDOW_DURATION after the end of the
+// transmission.
+static const int64_t RX1_CLOSE_TO_RX2_OPEN_MS = RECEIVE_DELAY2_MS
+  - RECEIVE_DELAY1_MS - RECEIVE_WINDOW_DURATION_MS;
+
 TypeId
 EndDeviceLoraMac::GetTypeId (void)
 {
   static TypeId tid = TypeId ("ns3::EndDeviceLoraMac")
     .SetParent<LoraMac> ()
     .SetGroupName ("lorawan")
+    .AddConstructor<EndDeviceLoraMac> ()
+    .AddAttribute ("MaxTxQueueSize",
+                   "Maximum number of application packets waiting for "
+                   "the duty cycle to allow their transmission",
+                   UintegerValue (8),
+                   MakeUintegerAccessor (&EndDeviceLoraMac::SetMaxTxQueueSize,
+                                         &EndDeviceLoraMac::GetMaxTxQueueSize),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("TxQueuePolicy",
+                   "What to do with a new application packet when the "
+                   "transmit queue is full",
+                   EnumValue (EndDeviceLoraMac::DROP_OLDEST),
+                   MakeEnumAccessor (&EndDeviceLoraMac::m_txQueuePolicy),
+                   MakeEnumChecker (EndDeviceLoraMac::DROP_NEWEST, "DropNewest",
+                                    EndDeviceLoraMac::DROP_OLDEST, "DropOldest",
+                                    EndDeviceLoraMac::COALESCE, "Coalesce"))
+    .AddAttribute ("Aggregation",
+                   "Whether queued application payloads are sent together "
+                   "in one frame, up to the maximum payload size of the "
+                   "data rate",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&EndDeviceLoraMac::m_aggregation),
+                   MakeBooleanChecker ())
+    .AddAttribute ("MaxAggregationDelay",
+                   "Maximum time an application payload waits for others "
+                   "to fill its frame, when aggregation is enabled",
+                   TimeValue (Seconds (60)),
+                   MakeTimeAccessor (&EndDeviceLoraMac::m_maxAggregationDelay),
+                   MakeTimeChecker ())
+    .AddAttribute ("ADR",
+                   "Whether to set the ADR bit of uplink frames, letting the "
+                   "network server set the data rate and transmission power "
+                   "through LinkAdrReq, and lower the data rate on "
+                   "retransmissions",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&EndDeviceLoraMac::SetDataRateAdaptation,
+                                        &EndDeviceLoraMac::GetDataRateAdaptation),
+                   MakeBooleanChecker ())
     .AddTraceSource ("RequiredTransmissions",
                      "Total number of transmissions required to deliver this packet",
                      MakeTraceSourceAccessor
@@ -72,53 +132,63 @@ EndDeviceLoraMac::GetTypeId (void)
                      MakeTraceSourceAccessor
                        (&EndDeviceLoraMac::m_aggregatedDutyCycle),
                      "ns3::TracedValueCallback::Double")
-    .AddConstructor<EndDeviceLoraMac> ();
+    .AddTraceSource ("TxQueueDepth",
+                     "Number of application packets waiting for "
+                     "transmission",
+                     MakeTraceSourceAccessor
+                       (&EndDeviceLoraMac::m_txQueueDepth),
+                     "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("TxQueueDelay",
+                     "A packet left the transmit queue after the "
+                     "specified delay",
+                     MakeTraceSourceAccessor
+                       (&EndDeviceLoraMac::m_txQueueDelay),
+                     "ns3::EndDeviceLoraMac::QueueingDelayTracedCallback")
+    .AddTraceSource ("TxQueueDrop",
+                     "A packet was discarded because the transmit queue "
+                     "was full",
+                     MakeTraceSourceAccessor
+                       (&EndDeviceLoraMac::m_txQueueDrop),
+                     "ns3::Packet::TracedCallback")
+    .AddTraceSource ("AggregatedFrame",
+                     "A frame carrying several application payloads "
+                     "was sent",
+                     MakeTraceSourceAccessor
+                       (&EndDeviceLoraMac::m_aggregatedFrame),
+                     "ns3::EndDeviceLoraMac::AggregationTracedCallback");
   return tid;
 }
 
 EndDeviceLoraMac::EndDeviceLoraMac ()
-  : m_enableDRAdapt (false),
-  m_maxNumbTx (8),
+  : m_region (&GetLoraRegionProfile (EU868)),
   m_dataRate (0),
   m_txPower (12),
+  m_mType (LoraMacHeader::UNCONFIRMED_DATA_UP),
+  m_uplinkState (IDLE),
+  m_sf (7),
+  m_currentFCnt (0),
   m_codingRate (1),
   // LoraWAN default
-  m_headerDisabled (0),
-  // LoraWAN default
-  m_receiveDelay1 (Seconds (1)),
-  // LoraWAN default
-  m_receiveDelay2 (Seconds (2)),
-  // LoraWAN default
-  m_receiveWindowDuration (Seconds (0.01)),
-  m_address (LoraDeviceAddress (0)),
   m_rx1DrOffset (0),
+  m_armedTimers (0),
+  m_maxNumbTx (8),
   // LoraWAN default
+  m_headerDisabled (0),
+  m_enableDRAdapt (false),
+  m_retxPending (false),
+  m_aggregation (false),
+  m_aggregationHold (false),
+  m_address (LoraDeviceAddress (0)),
+  m_maxTxQueueSize (8),
+  m_txQueuePolicy (DROP_OLDEST),
+  m_maxAggregationDelay (Seconds (60)),
   m_lastKnownLinkMargin (0),
   m_lastKnownGatewayCount (0),
   m_aggregatedDutyCycle (1),
-  m_mType (LoraMacHeader::UNCONFIRMED_DATA_UP),
-  m_currentFCnt (0),
-  m_sf(7)
-
+  m_txQueueDepth (0)
 {
   NS_LOG_FUNCTION (this);
 
-  // Initialize the random variable we'll use to decide which channel to
-  // transmit on.
-  m_uniformRV = CreateObject<UniformRandomVariable> ();
-
-  // Void the two receiveWindow events
-  m_closeFirstWindow = EventId ();
-  m_closeFirstWindow.Cancel ();
-  m_closeSecondWindow = EventId ();
-  m_closeSecondWindow.Cancel ();
-  m_secondReceiveWindow = EventId ();
-  m_secondReceiveWindow.Cancel ();
-
-  // Void the transmission event
-  m_nextTx = EventId ();
-  m_nextTx.Cancel ();
-
   // Initialize structure for retransmission parameters
   m_retxParams = EndDeviceLoraMac::LoraRetxParameters ();
   m_retxParams.retxLeft = m_maxNumbTx;
@@ -138,8 +208,14 @@ EndDeviceLoraMac::Send (Ptr<Packet> packet)
 {
   NS_LOG_FUNCTION (this << packet);
 
+  if (IsQuiesced ())
+    {
+      NS_LOG_DEBUG ("Device is quiesced: packet discarded.");
+      return;
+    }
+
   // Check that payload length is below the allowed maximum
-  if (packet->GetSize () > m_maxAppPayloadForDataRate.at (m_dataRate))
+  if (packet->GetSize () > m_region->maxAppPayloadForDataRate[m_dataRate])
     {
       NS_LOG_WARN ("Attempting to send a packet larger than the maximum allowed"
                    << " size at this DataRate (DR" << unsigned(m_dataRate) <<
@@ -147,57 +223,165 @@ EndDeviceLoraMac::Send (Ptr<Packet> packet)
       return;
     }
 
+  if (packet == m_retxParams.packet)
+    {
+      // The retransmission procedure asks for a new attempt: it will be made
+      // when the queue is served, unless new packets are waiting
+      m_retxPending = true;
+    }
+  else
+    {
+      if (m_txQueue.size () >= m_maxTxQueueSize)
+        {
+          switch (m_txQueuePolicy)
+            {
+            case DROP_NEWEST:
+              NS_LOG_WARN ("Transmit queue is full: dropping the new packet.");
+              m_txQueueDrop (packet);
+              return;
+            case DROP_OLDEST:
+              NS_LOG_WARN ("Transmit queue is full: dropping the oldest packet.");
+              m_txQueueDrop (m_txQueue.front ().packet);
+              m_txQueue.pop_front ();
+              break;
+            case COALESCE:
+              NS_LOG_WARN ("Transmit queue is full: replacing the newest packet.");
+              m_txQueueDrop (m_txQueue.back ().packet);
+              m_txQueue.pop_back ();
+              break;
+            }
+        }
+
+      QueuedPacket queuedPacket;
+      queuedPacket.packet = packet;
+      queuedPacket.enqueueTime = Simulator::Now ();
+      m_txQueue.push_back (queuedPacket);
+      m_txQueueDepth = m_txQueue.size ();
+    }
+
+  // If a wake-up is already scheduled, the packet will be served then,
+  // unless the wake-up waits for payloads that are not needed anymore
+  if (!IsTimerArmed (NEXT_TX) || (m_aggregationHold && IsAggregateFull ()))
+    {
+      ServeTxQueue ();
+    }
+
+  if (!m_aggregationHold && !m_txQueue.empty ()
+      && m_txQueue.back ().packet == packet)
+    {
+      m_cannotSendBecauseDutyCycle (packet);
+    }
+}
+
+void
+EndDeviceLoraMac::postponeTransmission (Time netxTxDelay)
+{
+  NS_LOG_FUNCTION (this);
+  // Replace the previous wake-up time, if any.
+  ArmTimer (NEXT_TX, netxTxDelay);
+  NS_LOG_WARN ("Attempting to send, but the aggregate duty cycle won't allow it. Scheduling a tx at a delay "
+               << netxTxDelay.GetSeconds () << ".");
+}
+
+void
+EndDeviceLoraMac::ServeTxQueue (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_txQueue.empty () && !m_retxPending)
+    {
+      return;
+    }
+
+  // In aggregation mode, wait for more payloads to fill the frame, unless
+  // the oldest one has waited long enough
+  m_aggregationHold = false;
+  if (m_aggregation && !m_retxPending && !IsAggregateFull ())
+    {
+      Time holdEnd = m_txQueue.front ().enqueueTime + m_maxAggregationDelay;
+      if (holdEnd > Simulator::Now ())
+        {
+          NS_LOG_DEBUG ("Holding " << m_txQueue.size () <<
+                        " payloads until " << holdEnd.GetSeconds ());
+          m_aggregationHold = true;
+          ArmTimer (NEXT_TX, holdEnd - Simulator::Now ());
+          return;
+        }
+    }
+
   // If it is not possible to transmit now because of the duty cycle,
   // or because we are receiving, schedule a tx/retx later
-
   Time netxTxDelay = GetNextTransmissionDelay ();
+  if (netxTxDelay == Time::Max ())
+    {
+      NS_LOG_WARN ("No channel is enabled for uplink: cannot send.");
+      return;
+    }
   if (netxTxDelay != Seconds (0))
     {
       // Add the ACK_TIMEOUT random delay if it is a retransmission.
       if (m_retxParams.waitingAck)
         {
-          double ack_timeout = m_uniformRV->GetValue (1,3);
+          double ack_timeout = m_rng.GetValue (LoraCounterRng::ACK_TIMEOUT, 1, 3);
           netxTxDelay = netxTxDelay + Seconds (ack_timeout);
         }
-      postponeTransmission (netxTxDelay, packet);
+      postponeTransmission (netxTxDelay);
+      return;
     }
 
-  // Pick a channel on which to transmit the packet
+  // Make sure we can transmit at the current power on the channel SendToPhy
+  // will pick: since there is no waiting time, at least one is available
   Ptr<LogicalLoraChannel> txChannel = GetChannelForTx ();
+  NS_ASSERT (txChannel);
+  NS_ASSERT_MSG (m_txPower <= m_channelHelper.GetTxPowerForChannel (txChannel),
+                 " The selected power is too hight to be supported by this channel.");
+
+  // New packets from the application stop the retransmission procedure
+  m_retxPending = false;
 
-  if (!(txChannel && m_retxParams.retxLeft > 0))
+  if (!m_txQueue.empty ())
     {
-      if (!txChannel)
-        {
-          m_cannotSendBecauseDutyCycle (packet);
-        }
-      else
+      QueuedPacket head = m_txQueue.front ();
+      m_txQueue.pop_front ();
+      m_txQueueDelay (head.packet, Simulator::Now () - head.enqueueTime);
+
+      // Append the following payloads, as long as they fit
+      if (m_aggregation)
         {
-          NS_LOG_INFO ("Max number of transmission achieved: packet not transmitted.");
+          uint16_t maxPayload = m_region->maxAppPayloadForDataRate[m_dataRate];
+          uint32_t nPayloads = 1;
+          while (!m_txQueue.empty ()
+                 && head.packet->GetSize () + m_txQueue.front ().packet->GetSize ()
+                 <= maxPayload)
+            {
+              QueuedPacket next = m_txQueue.front ();
+              m_txQueue.pop_front ();
+              m_txQueueDelay (next.packet, Simulator::Now () - next.enqueueTime);
+              head.packet->AddAtEnd (next.packet);
+              nPayloads++;
+            }
+
+          if (nPayloads > 1)
+            {
+              NS_LOG_INFO ("Aggregated " << nPayloads << " payloads in a " <<
+                           head.packet->GetSize () << " bytes frame.");
+              m_aggregatedFrame (head.packet, nPayloads);
+            }
         }
+      m_txQueueDepth = m_txQueue.size ();
+
+      DoSend (head.packet);
+    }
+  else if (m_retxParams.waitingAck && m_retxParams.retxLeft > 0)
+    {
+      DoSend (m_retxParams.packet);
     }
   else
-  // the transmitting channel is available and we have not run out the maximum number of retransmissions
     {
-      // Make sure we can transmit at the current power on this channel
-      NS_ASSERT_MSG (m_txPower <= m_channelHelper.GetTxPowerForChannel (txChannel),
-                     " The selected power is too hight to be supported by this channel.");
-      DoSend (packet);
+      NS_LOG_INFO ("Max number of transmission achieved: packet not transmitted.");
     }
 }
 
-void
-EndDeviceLoraMac::postponeTransmission (Time netxTxDelay, Ptr<Packet> packet)
-{
-  NS_LOG_FUNCTION (this);
-  // Delete previously scheduled transmissions if any.
-  Simulator::Cancel (m_nextTx);
-  m_nextTx = Simulator::Schedule (netxTxDelay, &EndDeviceLoraMac::DoSend, this, packet);
-  NS_LOG_WARN ("Attempting to send, but the aggregate duty cycle won't allow it. Scheduling a tx at a delay "
-               << netxTxDelay.GetSeconds () << ".");
-}
-
-
 void
 EndDeviceLoraMac::DoSend (Ptr<Packet> packet)
 {
@@ -226,7 +410,7 @@ EndDeviceLoraMac::DoSend (Ptr<Packet> packet)
       packet->AddHeader (macHdr);
 
       // Reset MAC command list
-      m_macCommandList.clear ();
+      m_macCommandList.Clear ();
 
       if (m_retxParams.waitingAck)
         {
@@ -243,7 +427,7 @@ EndDeviceLoraMac::DoSend (Ptr<Packet> packet)
       // If this is the first transmission of a confirmed packet, save parameters for the (possible) next retransmissions.
       if (m_mType == LoraMacHeader::CONFIRMED_DATA_UP)
         {
-          m_retxParams.packet = packet->Copy ();
+          m_retxParams.packet = LoraPacketPool::AcquireCopy (packet);
           m_retxParams.retxLeft = m_maxNumbTx;
           m_retxParams.waitingAck = true;
           m_retxParams.firstAttempt = Simulator::Now ();
@@ -306,7 +490,7 @@ EndDeviceLoraMac::SendToPhy (Ptr<Packet> packetToSend)
   //params.sf =GetSfFromDataRate(m_dataRate);
   params.headerDisabled = m_headerDisabled;
   params.codingRate = m_codingRate;
-  params.bandwidthHz = GetBandwidthFromDataRate (m_dataRate);
+  params.bandwidthHz = m_region->GetBandwidth (m_dataRate);
   params.nPreamble = m_nPreambleSymbols;
   params.crcEnabled = 1;
   params.lowDataRateOptimizationEnabled = 0;
@@ -318,6 +502,7 @@ EndDeviceLoraMac::SendToPhy (Ptr<Packet> packetToSend)
   NS_LOG_DEBUG ("PacketToSend: " << packetToSend);
 // TODO verificar isso aqi
   NS_LOG_DEBUG ("TxPower: " << m_txPower);
+  SetUplinkState (TX);
   m_phy->Send (packetToSend, params, txChannel->GetFrequency (), m_txPower);
 
   //////////////////////////////////////////////
@@ -325,7 +510,8 @@ EndDeviceLoraMac::SendToPhy (Ptr<Packet> packetToSend)
   //////////////////////////////////////////////
 
   // Compute packet duration
-  Time duration = m_phy->GetOnAirTime (packetToSend, params);
+  Time duration = LoraOnAirTimeCache::GetOnAirTime (packetToSend->GetSize (),
+                                                    params);
 
   // Register the sent packet into the DutyCycleHelper
   m_channelHelper.AddEvent (duration, txChannel);
@@ -344,7 +530,7 @@ EndDeviceLoraMac::SendToPhy (Ptr<Packet> packetToSend)
                 ", replyDataRate: " << unsigned (replyDataRate) << ".");
 
   m_phy->GetObject<EndDeviceLoraPhy> ()->SetSpreadingFactor
-    (GetSfFromDataRate (replyDataRate));
+    (m_region->GetSf (replyDataRate));
 }
 
 //////////////////////////
@@ -356,8 +542,13 @@ EndDeviceLoraMac::Receive (Ptr<Packet const> packet)
 {
   NS_LOG_FUNCTION (this << packet);
 
+  if (IsQuiesced ())
+    {
+      return;
+    }
+
   // Work on a copy of the packet
-  Ptr<Packet> packetCopy = packet->Copy ();
+  Ptr<Packet> packetCopy = LoraPacketPool::AcquireCopy (packet);
 
   // Remove the Mac Header to get some information
   LoraMacHeader mHdr;
@@ -365,6 +556,12 @@ EndDeviceLoraMac::Receive (Ptr<Packet const> packet)
 
   NS_LOG_DEBUG ("Mac Header: " << mHdr);
 
+  // A reception in the second receive window ends the uplink procedure
+  if (m_uplinkState == RX2)
+    {
+      SetUplinkState (IDLE);
+    }
+
   // Only keep analyzing the packet if it's downlink
   if (!mHdr.IsUplink ())
     {
@@ -384,8 +581,10 @@ EndDeviceLoraMac::Receive (Ptr<Packet const> packet)
         {
           NS_LOG_INFO ("The message is for us!");
 
-          // If it exists, cancel the second receive window event
-          Simulator::Cancel (m_secondReceiveWindow);
+          // The uplink procedure is over: if it exists, cancel the second
+          // receive window event
+          SetUplinkState (IDLE);
+          CancelTimer (OPEN_SECOND_WINDOW);
 
           // Parse the MAC commands
           ParseCommands (fHdr);
@@ -405,7 +604,7 @@ EndDeviceLoraMac::Receive (Ptr<Packet const> packet)
           // packet in the second receive window and finding out, after the
           // fact, that the packet is not for us. In either case, if we no
           // longer have any retransmissions left, we declare failure.
-          if (m_retxParams.waitingAck && m_secondReceiveWindow.IsExpired ())
+          if (m_retxParams.waitingAck && !IsWaitingForReceiveWindows ())
             {
               if (m_retxParams.retxLeft == 0)
                 {
@@ -424,7 +623,7 @@ EndDeviceLoraMac::Receive (Ptr<Packet const> packet)
             }
         }
     }
-  else if (m_retxParams.waitingAck && m_secondReceiveWindow.IsExpired ())
+  else if (m_retxParams.waitingAck && !IsWaitingForReceiveWindows ())
     {
       NS_LOG_INFO ("The packet we are receiving is in uplink.");
       if (m_retxParams.retxLeft > 0)
@@ -451,10 +650,21 @@ EndDeviceLoraMac::FailedReception (Ptr<Packet const> packet)
 {
   NS_LOG_FUNCTION (this << packet);
 
+  if (IsQuiesced ())
+    {
+      return;
+    }
+
   // Switch to sleep after a failed reception
   m_phy->GetObject<EndDeviceLoraPhy> ()->SwitchToSleep ();
 
-  if (m_secondReceiveWindow.IsExpired () && m_retxParams.waitingAck)
+  // A reception in the second receive window ends the uplink procedure
+  if (m_uplinkState == RX2)
+    {
+      SetUplinkState (IDLE);
+    }
+
+  if (!IsWaitingForReceiveWindows () && m_retxParams.waitingAck)
     {
       if (m_retxParams.retxLeft > 0)
         {
@@ -527,9 +737,16 @@ EndDeviceLoraMac::ParseCommands (LoraFrameHeader frameHeader)
             // Cast the command
             Ptr<LinkAdrReq> linkAdrReq = (*it)->GetObject<LinkAdrReq> ();
 
+            // Convert the channel list to a mask once, here, so that
+            // OnLinkAdrReq only deals with word operations
+            LoraChannelMask enabledChannels;
+            bool channelMaskValid =
+              GetChannelMaskFromList (linkAdrReq->GetEnabledChannelsList (),
+                                      enabledChannels);
+
             // Call the appropriate function to take action
             OnLinkAdrReq (linkAdrReq->GetDataRate (), linkAdrReq->GetTxPower (),
-                          linkAdrReq->GetEnabledChannelsList (),
+                          enabledChannels, channelMaskValid,
                           linkAdrReq->GetRepetitions ());
 
             break;
@@ -614,7 +831,7 @@ EndDeviceLoraMac::ApplyNecessaryOptions (LoraFrameHeader& frameHeader)
   frameHeader.SetAsUplink ();
   frameHeader.SetFPort (1);             // TODO Use an appropriate frame port based on the application
   frameHeader.SetAddress (m_address);
-  frameHeader.SetAdr (0);             // TODO Set ADR if a member variable is true
+  frameHeader.SetAdr (m_enableDRAdapt);
   frameHeader.SetAdrAckReq (0);             // TODO Set ADRACKREQ if a member variable is true
   if (m_mType == LoraMacHeader::CONFIRMED_DATA_UP)
     {
@@ -628,13 +845,14 @@ EndDeviceLoraMac::ApplyNecessaryOptions (LoraFrameHeader& frameHeader)
   frameHeader.SetFCnt (m_currentFCnt);
 
   // Add listed MAC commands
-  for (const auto &command : m_macCommandList)
+  for (MacCommandBuffer::ConstIterator it = m_macCommandList.Begin ();
+       it != m_macCommandList.End (); ++it)
     {
       NS_LOG_INFO ("Applying a MAC Command of CID " <<
                    unsigned(MacCommand::GetCIDFromMacCommand
-                              (command->GetCommandType ())));
+                              ((*it)->GetCommandType ())));
 
-      frameHeader.AddCommand (command);
+      frameHeader.AddCommand (*it);
     }
 
 }
@@ -666,17 +884,26 @@ EndDeviceLoraMac::TxFinished (Ptr<const Packet> packet)
 {
   NS_LOG_FUNCTION_NOARGS ();
 
-  // Schedule the opening of the first receive window
-  Simulator::Schedule (m_receiveDelay1,
-                       &EndDeviceLoraMac::OpenFirstReceiveWindow, this);
+  // The energy source may have been depleted during the transmission
+  if (IsQuiesced ())
+    {
+      return;
+    }
 
-  // Schedule the opening of the second receive window
-  m_secondReceiveWindow = Simulator::Schedule (m_receiveDelay2,
-                                               &EndDeviceLoraMac::OpenSecondReceiveWindow,
-                                               this);
+  // Schedule the opening of the first receive window. The second one is
+  // scheduled when the first one closes.
+  SetUplinkState (WAIT_RX1);
+  ArmTimer (OPEN_FIRST_WINDOW, MilliSeconds (RECEIVE_DELAY1_MS));
 
   // Switch the PHY to sleep
   m_phy->GetObject<EndDeviceLoraPhy> ()->SwitchToSleep ();
+
+  // Schedule the transmission of the next queued packet, now that the
+  // receive windows are known
+  if (!m_txQueue.empty () && !IsTimerArmed (NEXT_TX))
+    {
+      ServeTxQueue ();
+    }
 }
 
 void
@@ -685,13 +912,13 @@ EndDeviceLoraMac::OpenFirstReceiveWindow (void)
   NS_LOG_FUNCTION_NOARGS ();
 
   // Set Phy in Standby mode
+  SetUplinkState (RX1);
   m_phy->GetObject<EndDeviceLoraPhy> ()->SwitchToStandby ();
 
   // Schedule return to sleep after "at least the time required by the end
   // device's radio transceiver to effectively detect a downlink preamble"
   // (LoraWAN specification)
-  m_closeFirstWindow = Simulator::Schedule (m_receiveWindowDuration,
-                                            &EndDeviceLoraMac::CloseFirstReceiveWindow, this);
+  ArmTimer (CLOSE_FIRST_WINDOW, MilliSeconds (RECEIVE_WINDOW_DURATION_MS));
 }
 
 void
@@ -723,6 +950,15 @@ EndDeviceLoraMac::CloseFirstReceiveWindow (void)
       phy->SwitchToSleep ();
       break;
     }
+
+  // Unless a downlink for us was already received, schedule the second
+  // receive window. If the PHY is still receiving then, the window is not
+  // opened and Receive or FailedReception end the procedure.
+  if (m_uplinkState == RX1)
+    {
+      SetUplinkState (WAIT_RX2);
+      ArmTimer (OPEN_SECOND_WINDOW, MilliSeconds (RX1_CLOSE_TO_RX2_OPEN_MS));
+    }
 }
 
 void
@@ -730,6 +966,8 @@ EndDeviceLoraMac::OpenSecondReceiveWindow (void)
 {
   NS_LOG_FUNCTION_NOARGS ();
 
+  SetUplinkState (RX2);
+
   // Check for receiver status: if it's locked on a packet, don't open this
   // window at all.
   if (m_phy->GetObject<EndDeviceLoraPhy> ()->GetState () == EndDeviceLoraPhy::RX)
@@ -748,14 +986,13 @@ EndDeviceLoraMac::OpenSecondReceiveWindow (void)
 
   m_phy->GetObject<EndDeviceLoraPhy> ()->SetFrequency
     (m_secondReceiveWindowFrequency);
-  m_phy->GetObject<EndDeviceLoraPhy> ()->SetSpreadingFactor (GetSfFromDataRate
+  m_phy->GetObject<EndDeviceLoraPhy> ()->SetSpreadingFactor (m_region->GetSf
                                                                (m_secondReceiveWindowDataRate));
 
   // Schedule return to sleep after "at least the time required by the end
   // device's radio transceiver to effectively detect a downlink preamble"
   // (LoraWAN specification)
-  m_closeSecondWindow = Simulator::Schedule (m_receiveWindowDuration,
-                                             &EndDeviceLoraMac::CloseSecondReceiveWindow, this);
+  ArmTimer (CLOSE_SECOND_WINDOW, MilliSeconds (RECEIVE_WINDOW_DURATION_MS));
 }
 
 void
@@ -787,6 +1024,8 @@ EndDeviceLoraMac::CloseSecondReceiveWindow (void)
       break;
     }
 
+  SetUplinkState (IDLE);
+
   if (m_retxParams.waitingAck)
     {
       NS_LOG_DEBUG ("No reception initiated by PHY: rescheduling transmission.");
@@ -856,17 +1095,37 @@ EndDeviceLoraMac::GetNextTransmissionDelay (void)
 
   //    Check if there are receiving windows    //
 
-  if (!m_closeFirstWindow.IsExpired () || !m_closeSecondWindow.IsExpired () || !m_secondReceiveWindow.IsExpired () )
+  if (m_uplinkState != IDLE)
     {
       NS_LOG_WARN ("Attempting to send when there are receive windows:" <<
                    " Transmission postponed.");
-      Time endSecondRxWindow = (m_receiveDelay2 + m_receiveWindowDuration);
+      Time endSecondRxWindow = MilliSeconds (RECEIVE_DELAY2_MS
+                                             + RECEIVE_WINDOW_DURATION_MS);
       waitingTime = std::max (waitingTime, endSecondRxWindow);
     }
 
   return waitingTime;
 }
 
+bool
+EndDeviceLoraMac::IsAggregateFull (void) const
+{
+  uint16_t maxPayload = m_region->maxAppPayloadForDataRate[m_dataRate];
+  uint32_t size = 0;
+  for (std::deque<QueuedPacket>::const_iterator it = m_txQueue.begin ();
+       it != m_txQueue.end (); ++it)
+    {
+      size += it->packet->GetSize ();
+      if (size >= maxPayload)
+        {
+          return true;
+        }
+    }
+
+  // A full queue cannot take more payloads either
+  return m_txQueue.size () >= m_maxTxQueueSize;
+}
+
 Ptr<LogicalLoraChannel>
 EndDeviceLoraMac::GetChannelForTx (void)
 {
@@ -908,6 +1167,305 @@ EndDeviceLoraMac::GetChannelForTx (void)
 }
 
 
+////////////////
+// MAC timers //
+////////////////
+
+uint64_t EndDeviceLoraMac::m_nTimerEvents = 0;
+uint64_t EndDeviceLoraMac::m_nPendingTimerEvents = 0;
+
+void
+EndDeviceLoraMac::ArmTimer (MacTimer timer, Time delay)
+{
+  NS_LOG_FUNCTION (this << timer << delay.GetSeconds ());
+
+  m_timerExpiration[timer] = Simulator::Now () + delay;
+  m_armedTimers |= (1 << timer);
+
+  ScheduleTimerEvent ();
+}
+
+void
+EndDeviceLoraMac::CancelTimer (MacTimer timer)
+{
+  NS_LOG_FUNCTION (this << timer);
+
+  m_armedTimers &= ~(1 << timer);
+}
+
+bool
+EndDeviceLoraMac::IsTimerArmed (MacTimer timer) const
+{
+  return m_armedTimers & (1 << timer);
+}
+
+void
+EndDeviceLoraMac::ScheduleTimerEvent (void)
+{
+  if (!m_armedTimers)
+    {
+      return;
+    }
+
+  Time earliest = Time::Max ();
+  for (int i = 0; i < N_MAC_TIMERS; i++)
+    {
+      if (m_armedTimers & (1 << i))
+        {
+          earliest = std::min (earliest, m_timerExpiration[i]);
+        }
+    }
+
+  // The pending event, if any, already serves an earlier timer
+  if (m_timerEvent.IsRunning ()
+      && TimeStep (m_timerEvent.GetTs ()) <= earliest)
+    {
+      return;
+    }
+
+  if (m_timerEvent.IsRunning ())
+    {
+      m_timerEvent.Cancel ();
+      m_nPendingTimerEvents--;
+    }
+  m_timerEvent = Simulator::Schedule (earliest - Simulator::Now (),
+                                      &EndDeviceLoraMac::ExpireTimers, this);
+  m_nTimerEvents++;
+  m_nPendingTimerEvents++;
+}
+
+void
+EndDeviceLoraMac::ExpireTimers (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  m_nPendingTimerEvents--;
+
+  // Handlers can arm or cancel timers, so look for the next expired one
+  // after each call. Timers expiring at the same time run in the order of
+  // the uplink procedure.
+  while (m_armedTimers)
+    {
+      int next = -1;
+      for (int i = 0; i < N_MAC_TIMERS; i++)
+        {
+          if ((m_armedTimers & (1 << i))
+              && (next < 0 || m_timerExpiration[i] < m_timerExpiration[next]))
+            {
+              next = i;
+            }
+        }
+      if (m_timerExpiration[next] > Simulator::Now ())
+        {
+          break;
+        }
+
+      m_armedTimers &= ~(1 << next);
+      switch (next)
+        {
+        case OPEN_FIRST_WINDOW:
+          OpenFirstReceiveWindow ();
+          break;
+        case CLOSE_FIRST_WINDOW:
+          CloseFirstReceiveWindow ();
+          break;
+        case OPEN_SECOND_WINDOW:
+          OpenSecondReceiveWindow ();
+          break;
+        case CLOSE_SECOND_WINDOW:
+          CloseSecondReceiveWindow ();
+          break;
+        case NEXT_TX:
+          ServeTxQueue ();
+          break;
+        }
+    }
+
+  // Make sure the earliest armed timer has an event
+  ScheduleTimerEvent ();
+}
+
+void
+EndDeviceLoraMac::SetUplinkState (enum UplinkState state)
+{
+  NS_LOG_DEBUG ("Uplink state " << m_uplinkState << " -> " << state);
+
+  m_uplinkState = state;
+}
+
+bool
+EndDeviceLoraMac::IsWaitingForReceiveWindows (void) const
+{
+  return m_uplinkState == TX || m_uplinkState == WAIT_RX1
+         || m_uplinkState == RX1 || m_uplinkState == WAIT_RX2;
+}
+
+enum EndDeviceLoraMac::UplinkState
+EndDeviceLoraMac::GetUplinkState (void) const
+{
+  return m_uplinkState;
+}
+
+void
+EndDeviceLoraMac::Quiesce (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (IsQuiesced ())
+    {
+      return;
+    }
+  MarkQuiesced ();
+
+  // The depletion is usually raised by a state change of the PHY, in TX or
+  // RX: only an idle PHY is put to sleep here. A transmission or reception
+  // ends on its own, and its notification is ignored.
+  Ptr<EndDeviceLoraPhy> phy = m_phy->GetObject<EndDeviceLoraPhy> ();
+  if (phy->GetState () == EndDeviceLoraPhy::STANDBY)
+    {
+      phy->SwitchToSleep ();
+    }
+}
+
+void
+EndDeviceLoraMac::MarkQuiesced (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  SetUplinkState (QUIESCED);
+
+  // Drop every timer and the event that serves them
+  m_armedTimers = 0;
+  if (m_timerEvent.IsRunning ())
+    {
+      m_timerEvent.Cancel ();
+      m_nPendingTimerEvents--;
+    }
+
+  m_txQueue.clear ();
+  m_txQueueDepth = 0;
+  m_retxPending = false;
+  m_retxParams.waitingAck = false;
+  m_retxParams.packet = 0;
+  m_macCommandList.Clear ();
+}
+
+bool
+EndDeviceLoraMac::IsQuiesced (void) const
+{
+  return m_uplinkState == QUIESCED;
+}
+
+void
+EndDeviceLoraMac::SaveState (SavedState &state)
+{
+  for (int purpose = 0; purpose < LoraCounterRng::N_PURPOSES; purpose++)
+    {
+      state.nDraws[purpose] = m_rng.GetNDraws (LoraCounterRng::Purpose (purpose));
+    }
+  state.txPower = m_txPower;
+  state.aggregatedDutyCycle = m_aggregatedDutyCycle;
+  state.nextTx = IsTimerArmed (NEXT_TX) ?
+    m_timerExpiration[NEXT_TX] - Simulator::Now () : Time::Max ();
+  state.retxFirstAttempt = m_retxParams.firstAttempt - Simulator::Now ();
+  state.dataRate = m_dataRate;
+  state.sf = m_sf;
+  state.fCnt = m_currentFCnt;
+  state.retxLeft = m_retxParams.retxLeft;
+  state.waitingAck = m_retxParams.waitingAck;
+  // An uplink in progress is cut by the checkpoint: its retransmission, if
+  // any, is made once the device is restored
+  state.retxPending = m_retxPending
+    || (m_retxParams.waitingAck && m_retxParams.retxLeft > 0
+        && m_uplinkState != IDLE && m_uplinkState != QUIESCED);
+  state.quiesced = IsQuiesced ();
+
+  std::vector<Ptr<LogicalLoraChannel> > channels = m_channelHelper.GetChannelList ();
+  state.channelWaitingTimes.resize (channels.size ());
+  for (std::size_t i = 0; i < channels.size (); i++)
+    {
+      state.channelWaitingTimes[i] = m_channelHelper.GetWaitingTime (channels[i]);
+    }
+
+  state.retxPacket = m_retxParams.waitingAck ? m_retxParams.packet : Ptr<Packet> ();
+  state.txQueue.resize (m_txQueue.size ());
+  for (std::size_t i = 0; i < m_txQueue.size (); i++)
+    {
+      state.txQueue[i].first = m_txQueue[i].packet;
+      state.txQueue[i].second = m_txQueue[i].enqueueTime - Simulator::Now ();
+    }
+}
+
+void
+EndDeviceLoraMac::RestoreState (const SavedState &state)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (state.quiesced)
+    {
+      MarkQuiesced ();
+      return;
+    }
+
+  for (int purpose = 0; purpose < LoraCounterRng::N_PURPOSES; purpose++)
+    {
+      m_rng.SetNDraws (LoraCounterRng::Purpose (purpose), state.nDraws[purpose]);
+    }
+  m_txPower = state.txPower;
+  m_aggregatedDutyCycle = state.aggregatedDutyCycle;
+  m_dataRate = state.dataRate;
+  m_sf = state.sf;
+  m_currentFCnt = state.fCnt;
+
+  // The duty cycle is kept per sub-band: channels of the same sub-band have
+  // the same waiting time
+  std::vector<Ptr<LogicalLoraChannel> > channels = m_channelHelper.GetChannelList ();
+  for (std::size_t i = 0; i < channels.size () && i < state.channelWaitingTimes.size (); i++)
+    {
+      if (state.channelWaitingTimes[i].IsStrictlyPositive ())
+        {
+          m_channelHelper.GetSubBandFromChannel (channels[i])->SetNextTransmissionTime
+            (Simulator::Now () + state.channelWaitingTimes[i]);
+        }
+    }
+
+  m_retxParams.firstAttempt = Simulator::Now () + state.retxFirstAttempt;
+  m_retxParams.retxLeft = state.retxLeft;
+  m_retxParams.waitingAck = state.waitingAck && state.retxPacket;
+  m_retxParams.packet = m_retxParams.waitingAck ? state.retxPacket : Ptr<Packet> ();
+  m_retxPending = state.retxPending && m_retxParams.waitingAck;
+
+  m_txQueue.clear ();
+  for (std::size_t i = 0; i < state.txQueue.size (); i++)
+    {
+      QueuedPacket queuedPacket;
+      queuedPacket.packet = state.txQueue[i].first;
+      queuedPacket.enqueueTime = Simulator::Now () + state.txQueue[i].second;
+      m_txQueue.push_back (queuedPacket);
+    }
+  m_txQueueDepth = m_txQueue.size ();
+
+  // Serve the queue when it was due, or right away if an uplink was in
+  // progress
+  if (!m_txQueue.empty () || m_retxPending)
+    {
+      ArmTimer (NEXT_TX, state.nextTx == Time::Max () ?
+                Seconds (0) : std::max (state.nextTx, Seconds (0)));
+    }
+}
+
+uint64_t
+EndDeviceLoraMac::GetNTimerEvents (void)
+{
+  return m_nTimerEvents;
+}
+
+uint64_t
+EndDeviceLoraMac::GetNPendingTimerEvents (void)
+{
+  return m_nPendingTimerEvents;
+}
+
 std::vector<Ptr<LogicalLoraChannel> >
 EndDeviceLoraMac::Shuffle (std::vector<Ptr<LogicalLoraChannel> > vector)
 {
@@ -917,7 +1475,8 @@ EndDeviceLoraMac::Shuffle (std::vector<Ptr<LogicalLoraChannel> > vector)
 
   for (int i = 0; i < size; ++i)
     {
-      uint16_t random = std::floor (m_uniformRV->GetValue (0, size));
+      uint16_t random = std::floor (m_rng.GetValue (LoraCounterRng::CHANNEL_SHUFFLE,
+                                                    0, size));
       Ptr<LogicalLoraChannel> temp = vector.at (random);
       vector.at (random) = vector.at (i);
       vector.at (i) = temp;
@@ -937,8 +1496,13 @@ void EndDeviceLoraMac::resetRetransmissionParameters ()
   m_retxParams.packet = 0;
   m_retxParams.firstAttempt = Seconds (0);
 
-  // Cancel next retransmissions, if any
-  Simulator::Cancel (m_nextTx);
+  // Cancel next retransmissions, if any. Queued packets still need the
+  // wake-up.
+  m_retxPending = false;
+  if (m_txQueue.empty ())
+    {
+      CancelTimer (NEXT_TX);
+    }
 }
 
 void
@@ -949,7 +1513,7 @@ EndDeviceLoraMac::SetDataRateAdaptation (bool adapt)
 }
 
 bool
-EndDeviceLoraMac::GetDataRateAdaptation (void)
+EndDeviceLoraMac::GetDataRateAdaptation (void) const
 {
   return m_enableDRAdapt;
 }
@@ -974,6 +1538,8 @@ void
 EndDeviceLoraMac::SetDataRate (uint8_t dataRate)
 {
   NS_LOG_FUNCTION (this << unsigned (dataRate));
+  NS_ASSERT_MSG (dataRate < LORA_MAX_DATA_RATES, "Invalid data rate DR" <<
+                 unsigned (dataRate));
 
   m_dataRate = dataRate;
 }
@@ -995,12 +1561,33 @@ EndDeviceLoraMac::SetSf (uint8_t sf)
   m_sf = sf;
 }
 
+uint8_t
+EndDeviceLoraMac::GetSf (void) const
+{
+  return m_sf;
+}
+
+void
+EndDeviceLoraMac::SetRegion (LoraRegion region)
+{
+  NS_LOG_FUNCTION (this << region);
+
+  m_region = &GetLoraRegionProfile (region);
+}
+
+const LoraRegionProfile &
+EndDeviceLoraMac::GetRegionProfile (void) const
+{
+  return *m_region;
+}
+
 void
 EndDeviceLoraMac::SetDeviceAddress (LoraDeviceAddress address)
 {
   NS_LOG_FUNCTION (this << address);
 
   m_address = address;
+  m_rng.SetStream (address.Get ());
 }
 
 LoraDeviceAddress
@@ -1020,42 +1607,58 @@ EndDeviceLoraMac::OnLinkCheckAns (uint8_t margin, uint8_t gwCnt)
   m_lastKnownGatewayCount = gwCnt;
 }
 
+bool
+EndDeviceLoraMac::GetChannelMaskFromList (const std::list<int> &enabledChannels,
+                                          LoraChannelMask &mask)
+{
+  mask.reset ();
+  for (std::list<int>::const_iterator it = enabledChannels.begin ();
+       it != enabledChannels.end (); ++it)
+    {
+      if (*it < 0 || *it >= LORA_MAX_CHANNELS)
+        {
+          return false;
+        }
+      mask.set (*it);
+    }
+  return true;
+}
+
 void
 EndDeviceLoraMac::OnLinkAdrReq (uint8_t dataRate, uint8_t txPower,
-                                std::list<int> enabledChannels, int repetitions)
+                                LoraChannelMask enabledChannels,
+                                bool channelMaskValid, int repetitions)
 {
   NS_LOG_FUNCTION (this << unsigned (dataRate) << unsigned (txPower) <<
-                   repetitions);
+                   enabledChannels << channelMaskValid << repetitions);
 
-  // Three bools for three requirements before setting things up
-  bool channelMaskOk = true;
+  // Three bools for three requirements before setting things up. A mask
+  // that listed a channel the bitset cannot hold is rejected as a whole.
+  bool channelMaskOk = channelMaskValid;
   bool dataRateOk = true;
   bool txPowerOk = true;
 
   // Check the channel mask
   /////////////////////////
-  // Check whether all specified channels exist on this device
-  auto channelList = m_channelHelper.GetChannelList ();
-  int channelListSize = channelList.size ();
+  // Check whether all specified channels exist on this device, i.e., that no
+  // bit is set past the last channel in the helper
+  std::vector<Ptr<LogicalLoraChannel> > channelList = m_channelHelper.GetChannelList ();
+  std::size_t channelListSize = std::min<std::size_t> (channelList.size (),
+                                                       LORA_MAX_CHANNELS);
 
-  for (auto it = enabledChannels.begin (); it != enabledChannels.end (); it++)
+  if ((enabledChannels >> channelListSize).any ())
     {
-      if ((*it) > channelListSize)
-        {
-          channelMaskOk = false;
-          break;
-        }
+      channelMaskOk = false;
     }
 
   // Check the dataRate
   /////////////////////
   // We need to know we can use it at all
   // To assess this, we try and convert it to a SF/BW combination and check if
-  // those values are valid. Since GetSfFromDataRate and
-  // GetBandwidthFromDataRate return 0 if the dataRate is not recognized, we
-  // can check against this.
-  uint8_t sf = GetSfFromDataRate (dataRate);
-  double bw = GetBandwidthFromDataRate (dataRate);
+  // those values are valid. Since the region table has a SF and bandwidth of
+  // 0 for data rates it does not define, we can check against this.
+  uint8_t sf = m_region->GetSf (dataRate);
+  double bw = m_region->GetBandwidth (dataRate);
   NS_LOG_DEBUG ("SF: " << unsigned (sf) << ", BW: " << bw);
   if (sf == 0 || bw == 0)
     {
@@ -1069,12 +1672,16 @@ EndDeviceLoraMac::OnLinkAdrReq (uint8_t dataRate, uint8_t txPower,
   if (dataRateOk && channelMaskOk)             // If false, skip the check
     {
       bool foundAvailableChannel = false;
-      for (auto it = enabledChannels.begin (); it != enabledChannels.end (); it++)
+      for (std::size_t i = 0; i < channelListSize; i++)
         {
-          NS_LOG_DEBUG ("MinDR: " << unsigned (channelList.at (*it)->GetMinimumDataRate ()));
-          NS_LOG_DEBUG ("MaxDR: " << unsigned (channelList.at (*it)->GetMaximumDataRate ()));
-          if (channelList.at (*it)->GetMinimumDataRate () <= dataRate
-              && channelList.at (*it)->GetMaximumDataRate () >= dataRate)
+          if (!enabledChannels.test (i))
+            {
+              continue;
+            }
+          NS_LOG_DEBUG ("MinDR: " << unsigned (channelList[i]->GetMinimumDataRate ()));
+          NS_LOG_DEBUG ("MaxDR: " << unsigned (channelList[i]->GetMaximumDataRate ()));
+          if (channelList[i]->GetMinimumDataRate () <= dataRate
+              && channelList[i]->GetMaximumDataRate () >= dataRate)
             {
               foundAvailableChannel = true;
               break;
@@ -1090,8 +1697,8 @@ EndDeviceLoraMac::OnLinkAdrReq (uint8_t dataRate, uint8_t txPower,
 
   // Check the txPower
   ////////////////////
-  // Check whether we can use this transmission power
-  if (GetDbmForTxPower (txPower) == 0)
+  // Check whether the region defines this transmission power
+  if (m_region->GetTxPowerDbm (txPower) == 0)
     {
       txPowerOk = false;
     }
@@ -1105,32 +1712,34 @@ EndDeviceLoraMac::OnLinkAdrReq (uint8_t dataRate, uint8_t txPower,
   //////////////////////////////////////////////////
   if (channelMaskOk && dataRateOk && txPowerOk)
     {
-      // Cycle over all channels in the list
-      for (uint32_t i = 0; i < m_channelHelper.GetChannelList ().size (); i++)
+      // Cycle over all channels in the list. The vector holds pointers to
+      // the helper's channels, so the copy taken above can be used. Channels
+      // that the mask cannot address are disabled.
+      for (std::size_t i = 0; i < channelList.size (); i++)
         {
-          if (std::find (enabledChannels.begin (), enabledChannels.end (), i) != enabledChannels.end ())
+          if (i < channelListSize && enabledChannels.test (i))
             {
-              m_channelHelper.GetChannelList ().at (i)->SetEnabledForUplink ();
+              channelList[i]->SetEnabledForUplink ();
               NS_LOG_DEBUG ("Channel " << i << " enabled");
             }
           else
             {
-              m_channelHelper.GetChannelList ().at (i)->DisableForUplink ();
+              channelList[i]->DisableForUplink ();
               NS_LOG_DEBUG ("Channel " << i << " disabled");
             }
         }
 
-      // Set the data rate
+      // Set the data rate, and the spreading factor used on the PHY
       m_dataRate = dataRate;
-// TODO descomentar a linha abaixo
-//      // Set the transmission power
-      m_txPower = GetDbmForTxPower (txPower);
+      m_sf = sf;
+      // Set the transmission power
+      m_txPower = m_region->GetTxPowerDbm (txPower);
     }
 
   // Craft a LinkAdrAns MAC command as a response
   ///////////////////////////////////////////////
-  m_macCommandList.push_back (CreateObject<LinkAdrAns> (txPowerOk, dataRateOk,
-                                                        channelMaskOk));
+  m_macCommandList.Add (MacCommandPool::GetLinkAdrAns (txPowerOk, dataRateOk,
+                                                       channelMaskOk));
 }
 
 void
@@ -1146,7 +1755,7 @@ EndDeviceLoraMac::OnDutyCycleReq (double dutyCycle)
 
   // Craft a DutyCycleAns as response
   NS_LOG_INFO ("Adding DutyCycleAns reply");
-  m_macCommandList.push_back (CreateObject<DutyCycleAns> ());
+  m_macCommandList.Add (MacCommandPool::GetDutyCycleAns ());
 }
 
 void
@@ -1159,14 +1768,13 @@ EndDeviceLoraMac::OnRxParamSetupReq (uint8_t rx1DrOffset, uint8_t rx2DataRate, d
   bool dataRateOk = true;
 
   // Check that the desired offset is valid
-  if ( !(0 <= rx1DrOffset && rx1DrOffset <= 5))
+  if (rx1DrOffset > m_region->maxRx1DrOffset)
     {
       offsetOk = false;
     }
 
   // Check that the desired data rate is valid
-  if (GetSfFromDataRate (rx2DataRate) == 0
-      || GetBandwidthFromDataRate (rx2DataRate) == 0)
+  if (!m_region->IsValidDataRate (rx2DataRate))
     {
       dataRateOk = false;
     }
@@ -1181,8 +1789,8 @@ EndDeviceLoraMac::OnRxParamSetupReq (uint8_t rx1DrOffset, uint8_t rx2DataRate, d
 
   // Craft a RxParamSetupAns as response
   NS_LOG_INFO ("Adding RxParamSetupAns reply");
-  m_macCommandList.push_back (CreateObject<RxParamSetupAns> (offsetOk,
-                                                             dataRateOk, true));
+  m_macCommandList.Add (MacCommandPool::GetRxParamSetupAns (offsetOk,
+                                                            dataRateOk, true));
 }
 
 void
@@ -1190,12 +1798,31 @@ EndDeviceLoraMac::OnDevStatusReq (void)
 {
   NS_LOG_FUNCTION (this);
 
-  uint8_t battery = 10;             // XXX Fake battery level
-  uint8_t margin = 10;             // XXX Fake margin
+  // The battery level is 1 (empty) to 254 (full), or 255 if the device
+  // cannot measure it
+  uint8_t battery = 255;
+  Ptr<EnergySourceContainer> sources;
+  if (m_device && m_device->GetNode ())
+    {
+      sources = m_device->GetNode ()->GetObject<EnergySourceContainer> ();
+    }
+  if (sources && sources->GetN () > 0)
+    {
+      double fraction = std::min (std::max (sources->Get (0)->GetEnergyFraction (),
+                                            0.0), 1.0);
+      battery = 1 + uint8_t (std::floor (fraction * 253 + 0.5));
+    }
 
-  // Craft a RxParamSetupAns as response
+  // The margin is a 6-bit signed integer, in dB
+  int margin = int (std::floor (m_lastKnownLinkMargin + 0.5));
+  margin = std::min (std::max (margin, -32), 31);
+
+  NS_LOG_DEBUG ("Battery: " << unsigned (battery) << ", margin: " << margin);
+
+  // Craft a DevStatusAns as response
   NS_LOG_INFO ("Adding DevStatusAns reply");
-  m_macCommandList.push_back (CreateObject<DevStatusAns> (battery, margin));
+  m_macCommandList.Add (MacCommandPool::GetDevStatusAns (battery,
+                                                         uint8_t (margin) & 0x3F));
 }
 
 void
@@ -1212,8 +1839,8 @@ EndDeviceLoraMac::OnNewChannelReq (uint8_t chIndex, double frequency, uint8_t mi
   SetLogicalChannel (chIndex, frequency, minDataRate, maxDataRate);
 
   NS_LOG_INFO ("Adding NewChannelAns reply");
-  m_macCommandList.push_back (CreateObject<NewChannelAns> (dataRateRangeOk,
-                                                           channelFrequencyOk));
+  m_macCommandList.Add (MacCommandPool::GetNewChannelAns (dataRateRangeOk,
+                                                          channelFrequencyOk));
 }
 
 void
@@ -1254,7 +1881,7 @@ EndDeviceLoraMac::AddSubBand (double startFrequency, double endFrequency, double
 uint8_t
 EndDeviceLoraMac::GetFirstReceiveWindowDataRate (void)
 {
-  return m_replyDataRateMatrix.at (m_dataRate).at (m_rx1DrOffset);
+  return m_region->replyDataRate[m_dataRate][m_rx1DrOffset];
 }
 
 void
@@ -1281,6 +1908,33 @@ EndDeviceLoraMac::GetSecondReceiveWindowFrequency (void)
   return m_secondReceiveWindowFrequency;
 }
 
+void
+EndDeviceLoraMac::SetMaxTxQueueSize (uint32_t maxSize)
+{
+  NS_LOG_FUNCTION (this << maxSize);
+  NS_ASSERT (maxSize > 0);
+
+  m_maxTxQueueSize = maxSize;
+  while (m_txQueue.size () > m_maxTxQueueSize)
+    {
+      m_txQueueDrop (m_txQueue.front ().packet);
+      m_txQueue.pop_front ();
+    }
+  m_txQueueDepth = m_txQueue.size ();
+}
+
+uint32_t
+EndDeviceLoraMac::GetMaxTxQueueSize (void) const
+{
+  return m_maxTxQueueSize;
+}
+
+uint32_t
+EndDeviceLoraMac::GetTxQueueSize (void) const
+{
+  return m_txQueue.size ();
+}
+
 double
 EndDeviceLoraMac::GetAggregatedDutyCycle (void)
 {
@@ -1294,7 +1948,7 @@ EndDeviceLoraMac::AddMacCommand (Ptr<MacCommand> macCommand)
 {
   NS_LOG_FUNCTION (this << macCommand);
 
-  m_macCommandList.push_back (macCommand);
+  m_macCommandList.Add (macCommand);
 }
 
 //TODO ONDE TA
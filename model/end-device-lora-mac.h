@@ -25,13 +25,31 @@
 #include "ns3/lora-mac.h"
 #include "ns3/lora-mac-header.h"
 #include "ns3/lora-frame-header.h"
-#include "ns3/random-variable-stream.h"
+#include "ns3/mac-command-pool.h"
+#include "ns3/lora-region-parameters.h"
+#include "ns3/lora-counter-rng.h"
 #include "ns3/lora-device-address.h"
 #include "ns3/traced-value.h"
+#include "ns3/event-id.h"
+#include <array>
+#include <bitset>
+#include <deque>
 
 namespace ns3 {
 namespace lorawan {
 
+/**
+ * Maximum number of logical channels a channel mask can address (64 + 8
+ * uplink channels in the US915 band plan).
+ */
+static const uint8_t LORA_MAX_CHANNELS = 72;
+
+/**
+ * A set of enabled channels, indexed by the channel's position in the
+ * LogicalLoraChannelHelper.
+ */
+typedef std::bitset<LORA_MAX_CHANNELS> LoraChannelMask;
+
 /**
  * Class representing the MAC layer of a LoRaWAN device.
  */
@@ -40,6 +58,57 @@ class EndDeviceLoraMac : public LoraMac
 public:
   static TypeId GetTypeId (void);
 
+  /**
+   * What to do with a packet from the application when the transmit queue
+   * is full.
+   */
+  enum TxQueuePolicy
+  {
+    DROP_NEWEST,      //!< Discard the packet that just arrived
+    DROP_OLDEST,      //!< Discard the packet at the head of the queue
+    COALESCE          //!< Replace the last queued packet with the new one
+  };
+
+  /**
+   * The steps of the uplink procedure.
+   *
+   * A transmission goes through TX, WAIT_RX1, RX1, WAIT_RX2 and RX2, and
+   * then back to IDLE. The procedure ends early, going back to IDLE, when a
+   * downlink for this device is received in the first window. A window
+   * state also covers the reception of a packet whose preamble was detected
+   * while the window was open. QUIESCED is terminal: see Quiesce.
+   */
+  enum UplinkState
+  {
+    IDLE,           //!< No uplink in progress
+    TX,             //!< The PHY is transmitting
+    WAIT_RX1,       //!< Waiting for the first receive window
+    RX1,            //!< The first receive window is open
+    WAIT_RX2,       //!< Waiting for the second receive window
+    RX2,            //!< The second receive window is open
+    QUIESCED        //!< The device is out of energy and does nothing
+  };
+
+  /**
+   * TracedCallback signature for the time a packet spent in the transmit
+   * queue.
+   *
+   * \param packet The packet leaving the queue.
+   * \param delay The time the packet was queued for.
+   */
+  typedef void (* QueueingDelayTracedCallback)
+    (Ptr<const Packet> packet, Time delay);
+
+  /**
+   * TracedCallback signature for frames carrying several application
+   * payloads.
+   *
+   * \param packet The aggregated payload, before the MAC headers are added.
+   * \param nPayloads The number of application payloads in the frame.
+   */
+  typedef void (* AggregationTracedCallback)
+    (Ptr<const Packet> packet, uint32_t nPayloads);
+
   EndDeviceLoraMac ();
   virtual ~EndDeviceLoraMac ();
 
@@ -51,6 +120,15 @@ public:
    * Send a packet.
    *
    * The MAC layer of the ED will take care of using the right parameters.
+   * Packets from the application are appended to the transmit queue, and
+   * wait there until the duty cycle and the receive windows allow to send
+   * them. A packet of the ongoing retransmission procedure does not take a
+   * queue slot, but gives way to queued packets.
+   *
+   * If aggregation is enabled, queued payloads are sent together in one
+   * frame, up to the maximum payload size of the current data rate. A
+   * payload is held for at most MaxAggregationDelay waiting for others to
+   * fill the frame.
    *
    * \param packet the packet to send
    */
@@ -71,11 +149,20 @@ public:
   virtual void SendToPhy (Ptr<Packet> packet);
 
   /**
-   * Postpone transmission to the specified time and delete previously scheduled transmissions if present.
+   * Postpone the service of the transmit queue to the specified time,
+   * replacing the previous wake-up time if present.
    *
    * \param nextTxDelay Delay at which the transmission will be performed.
    */
-  virtual void postponeTransmission (Time nextTxDelay, Ptr<Packet>);
+  virtual void postponeTransmission (Time nextTxDelay);
+
+  /**
+   * Send the packet at the head of the transmit queue, or the pending
+   * retransmission if the queue is empty, if the duty cycle and the receive
+   * windows allow it. Otherwise, postpone the transmission to the earliest
+   * time it may be allowed.
+   */
+  void ServeTxQueue (void);
 
 
   ///////////////////////
@@ -121,6 +208,87 @@ public:
    */
   void CloseSecondReceiveWindow (void);
 
+  /**
+   * Get the current step of the uplink procedure.
+   */
+  enum UplinkState GetUplinkState (void) const;
+
+  /**
+   * Permanently stop the device, typically because its energy source is
+   * depleted.
+   *
+   * All pending MAC timers are canceled, the transmit queue and the
+   * retransmission procedure are dropped and the PHY, if it is in STANDBY,
+   * is put to sleep; a transmission or reception in progress is left to
+   * end. From then on, packets handed to Send are discarded and PHY
+   * notifications are ignored, so the device does not schedule any more
+   * events.
+   */
+  void Quiesce (void);
+
+  /**
+   * Stop the device as Quiesce does, without touching the PHY: for a device
+   * restored as quiesced before the simulation starts, whose PHY is still
+   * in its initial state.
+   */
+  void MarkQuiesced (void);
+
+  /**
+   * Check whether Quiesce was called on this device.
+   */
+  bool IsQuiesced (void) const;
+
+  /**
+   * The state of the device that a checkpoint keeps. Times are relative to
+   * the time of the checkpoint.
+   */
+  struct SavedState
+  {
+    std::array<uint32_t, LoraCounterRng::N_PURPOSES> nDraws;
+    double txPower;
+    double aggregatedDutyCycle;
+    Time nextTx;                     //!< NEXT_TX timer delay, or Time::Max ()
+    Time retxFirstAttempt;           //!< Not positive
+    uint8_t dataRate;
+    uint8_t sf;
+    uint8_t fCnt;
+    uint8_t retxLeft;
+    bool waitingAck;
+    bool retxPending;
+    bool quiesced;
+    std::vector<Time> channelWaitingTimes;   //!< Duty cycle wait, per channel
+    Ptr<Packet> retxPacket;                  //!< With its MAC headers, or 0
+    std::vector<std::pair<Ptr<Packet>, Time> > txQueue;   //!< Packets, enqueue times
+  };
+
+  /**
+   * Save the state of the device, e.g., to checkpoint it.
+   *
+   * \param state The state, whose vectors are reused.
+   */
+  void SaveState (SavedState &state);
+
+  /**
+   * Restore a saved state on a device that did not send anything yet.
+   *
+   * An uplink that was in progress when the state was saved is not resumed:
+   * if it was confirmed, its retransmission procedure goes on as if its
+   * receive windows had closed without an acknowledgment.
+   */
+  void RestoreState (const SavedState &state);
+
+  /**
+   * Get the number of simulator events scheduled so far by the MAC timers of
+   * all end devices.
+   */
+  static uint64_t GetNTimerEvents (void);
+
+  /**
+   * Get the number of end devices that currently have a timer event pending
+   * in the simulator.
+   */
+  static uint64_t GetNPendingTimerEvents (void);
+
   /////////////////////////
   // Getters and Setters //
   /////////////////////////
@@ -140,7 +308,7 @@ public:
   /**
    * Get if data rate adaptation is enabled or not.
    */
-  bool GetDataRateAdaptation (void);
+  bool GetDataRateAdaptation (void) const;
 
   /**
    * Set the maximum number of transmissions allowed.
@@ -173,6 +341,28 @@ public:
 
   void SetSf (uint8_t sf);
 
+  /**
+   * Get the spreading factor this device transmits with.
+   */
+  uint8_t GetSf (void) const;
+
+  /**
+   * Set the region whose regional parameters (spreading factor and
+   * bandwidth of each data rate, payload sizes, RX1 data rates) this device
+   * uses.
+   *
+   * The default is EU868, which matches LoraMacHelper's default
+   * configuration.
+   *
+   * \param region The region.
+   */
+  void SetRegion (LoraRegion region);
+
+  /**
+   * Get the regional parameters this device uses.
+   */
+  const LoraRegionProfile & GetRegionProfile (void) const;
+
   /**
    * Set the network address of this device.
    *
@@ -240,6 +430,23 @@ public:
    */
   // uint8_t GetRx1DrOffset (void);
 
+  /**
+   * Set the maximum number of application packets waiting for transmission.
+   *
+   * \param maxSize The size of the transmit queue.
+   */
+  void SetMaxTxQueueSize (uint32_t maxSize);
+
+  /**
+   * Get the maximum number of application packets waiting for transmission.
+   */
+  uint32_t GetMaxTxQueueSize (void) const;
+
+  /**
+   * Get the number of application packets waiting for transmission.
+   */
+  uint32_t GetTxQueueSize (void) const;
+
   /**
    * Get the aggregated duty cycle.
    *
@@ -294,11 +501,28 @@ public:
    *
    * \param dataRate The data rate value of the command.
    * \param txPower The transmission power value of the command.
-   * \param enabledChannels A list of the enabled channels.
+   * \param enabledChannels The mask of the enabled channels.
+   * \param channelMaskValid Whether the command listed only channels the
+   *        mask can hold. If not, the channel mask is not acknowledged.
    * \param repetitions The number of repetitions prescribed by the command.
    */
   void OnLinkAdrReq (uint8_t dataRate, uint8_t txPower,
-                     std::list<int> enabledChannels, int repetitions);
+                     LoraChannelMask enabledChannels, bool channelMaskValid,
+                     int repetitions);
+
+  /**
+   * Convert a list of channel indexes, as carried by a LinkAdrReq, into a
+   * channel mask.
+   *
+   * Indexes that do not fit in a LoraChannelMask are reported through the
+   * return value, so that the request can be rejected.
+   *
+   * \param enabledChannels The list of enabled channel indexes.
+   * \param mask The mask to fill.
+   * \return false if some index was out of range.
+   */
+  static bool GetChannelMaskFromList (const std::list<int> &enabledChannels,
+                                      LoraChannelMask &mask);
 
   /**
    * Perform the actions that need to be taken when receiving a DutyCycleReq command.
@@ -383,6 +607,70 @@ public:
 
 
 private:
+  /**
+   * The timers an end device arms during the uplink procedure.
+   */
+  enum MacTimer
+  {
+    OPEN_FIRST_WINDOW,
+    CLOSE_FIRST_WINDOW,
+    OPEN_SECOND_WINDOW,
+    CLOSE_SECOND_WINDOW,
+    NEXT_TX,
+    N_MAC_TIMERS
+  };
+
+  /**
+   * Arm a timer so that it expires after the specified delay, replacing any
+   * previous expiration time.
+   *
+   * Only the earliest armed timer of the device has an event in the
+   * simulator, so arming a timer that expires after it does not touch the
+   * scheduler.
+   */
+  void ArmTimer (MacTimer timer, Time delay);
+
+  /**
+   * Disarm a timer. The simulator event, if any, is left to expire.
+   */
+  void CancelTimer (MacTimer timer);
+
+  /**
+   * Check whether a timer is armed and has not expired yet.
+   */
+  bool IsTimerArmed (MacTimer timer) const;
+
+  /**
+   * Make sure the earliest armed timer has an event in the simulator.
+   */
+  void ScheduleTimerEvent (void);
+
+  /**
+   * Run the handlers of all the expired timers, then schedule an event for
+   * the earliest timer that is still armed.
+   */
+  void ExpireTimers (void);
+
+  /**
+   * Move the uplink procedure to a new step.
+   */
+  void SetUplinkState (enum UplinkState state);
+
+  /**
+   * Check whether a receive window of the current uplink may still open, or
+   * is open.
+   */
+  bool IsWaitingForReceiveWindows (void) const;
+
+  /**
+   * An application packet waiting in the transmit queue.
+   */
+  struct QueuedPacket
+  {
+    Ptr<Packet> packet;
+    Time enqueueTime;
+  };
+
   /**
    * Structure representing the parameters that will be used in the
    * retransmission procedure.
@@ -395,16 +683,6 @@ private:
     uint8_t retxLeft;
   };
 
-  /**
-   * Enable Data Rate adaptation during the retransmission procedure.
-   */
-  bool m_enableDRAdapt;
-
-  /**
-   * Maximum number of transmission allowed.
-   */
-  uint8_t m_maxNumbTx;
-
   /**
    * Randomly shuffle a Ptr<LogicalLoraChannel> vector.
    *
@@ -418,6 +696,13 @@ private:
   Time GetNextTransmissionDelay (void);
 
 
+  /**
+   * Check whether the queued payloads fill a frame at the current data
+   * rate, i.e., whether waiting for more payloads cannot make the next frame
+   * larger.
+   */
+  bool IsAggregateFull (void) const;
+
   /**
    * Find a suitable channel for transmission. The channel is chosen among the
    * ones that are available in the ED's LogicalLoraChannel, based on their duty
@@ -425,12 +710,33 @@ private:
    */
   Ptr<LogicalLoraChannel> GetChannelForTx (void);
 
+  //////////////////////////////////////////////////////////////////////
+  // Per-uplink state. These members are read or written on every     //
+  // transmission and every timer expiration, so they are kept        //
+  // together, with the small ones packed, at the start of the object. //
+  //////////////////////////////////////////////////////////////////////
+
   /**
-   * An uniform random variable, used by the Shuffle method to randomly reorder
-   * the channel list.
+   * The regional parameters of this device, shared by all the devices of
+   * the same region.
    */
-  Ptr<UniformRandomVariable> m_uniformRV;
+  const LoraRegionProfile *m_region;
 
+  /**
+   * Expiration times of the MAC timers. Only the entries whose bit is set in
+   * m_armedTimers are meaningful.
+   */
+  std::array<Time, N_MAC_TIMERS> m_timerExpiration;
+
+  /**
+   * The single simulator event that serves the timers of this device.
+   */
+  EventId m_timerEvent;
+
+  /* Structure containing the retransmission parameters
+   * for this device.
+   */
+  struct LoraRetxParameters m_retxParams;
 
 /**
    * The total number of transmissions required.
@@ -449,88 +755,129 @@ TracedValue<uint8_t> m_requiredTx;
    */
   TracedValue<double> m_txPower;
 
+  /**
+   * The message type to apply to packets sent with the Send method.
+   */
+  LoraMacHeader::MType m_mType;
+
+  /**
+   * The current step of the uplink procedure.
+   */
+  enum UplinkState m_uplinkState;
+
+  uint8_t m_sf;
+
+  uint8_t m_currentFCnt;
+
   /**
    * The coding rate used by this device.
    */
   uint8_t m_codingRate;
 
   /**
-   * Whether or not the header is disabled for communications by this device.
+   * The RX1DROffset parameter value
    */
-  bool m_headerDisabled;
+  uint8_t m_rx1DrOffset;
 
   /**
-   * The interval between when a packet is done sending and when the first
-   * receive window is opened.
+   * Bit mask of the timers that are currently armed.
+   *
+   * The bit of a window event is cleared when the window is canceled (e.g.,
+   * the second receive window is not opened after a successful reception
+   * in the first one).
    */
-  Time m_receiveDelay1;
+  uint8_t m_armedTimers;
 
   /**
-   * The interval between when a packet is done sending and when the second
-   * receive window is opened.
+   * Maximum number of transmission allowed.
    */
-  Time m_receiveDelay2;
+  uint8_t m_maxNumbTx;
 
   /**
-   * The duration of a receive window.
+   * Whether or not the header is disabled for communications by this device.
    */
-  Time m_receiveWindowDuration;
+  bool m_headerDisabled;
 
   /**
-   * The event of the closing the first receive window.
-   *
-   * This Event will be canceled if there's a successful reception of a packet.
+   * Enable Data Rate adaptation during the retransmission procedure.
    */
-  EventId m_closeFirstWindow;
+  bool m_enableDRAdapt;
 
   /**
-   * The event of the closing the second receive window.
-   *
-   * This Event will be canceled if there's a successful reception of a packet.
+   * Whether the packet of the retransmission procedure is waiting for the
+   * NEXT_TX timer.
    */
-  EventId m_closeSecondWindow;
+  bool m_retxPending;
 
   /**
-   * The event of the second receive window opening.
-   *
-   * This Event is used to cancel the second window in case the first one is
-   * successful.
+   * Whether queued payloads are sent together in a single frame.
    */
-  EventId m_secondReceiveWindow;
+  bool m_aggregation;
 
   /**
-   * The event of retransmitting a packet in a consecutive moment if an ACK is not received.
-   *
-   * This Event is used to cancel the retransmission if the ACK is found in ParseCommand function and
-   * if a newer packet is delivered from the application to be sent.
+   * Whether the NEXT_TX timer is armed to wait for more payloads, rather
+   * than for the duty cycle or the receive windows.
    */
-  EventId m_nextTx;
+  bool m_aggregationHold;
 
   /**
-   * The event of transmitting a packet in a consecutive moment, when the duty cycle let us transmit.
-   *
-   * This Event is used to cancel the transmission of this packet if a newer packet is delivered from the application to be sent.
+   * The Data Rate to listen for during the second downlink transmission.
    */
-  EventId m_nextRetx;
+  uint8_t m_secondReceiveWindowDataRate;
+
+  /**
+   * The frequency to listen on for the second receive window.
+   */
+  double m_secondReceiveWindowFrequency;
+
   /**
    * The address of this device.
    */
   LoraDeviceAddress m_address;
 
   /**
-   * The frequency to listen on for the second receive window.
+   * The MAC commands that need to be applied to the next UL packet.
    */
-  double m_secondReceiveWindowFrequency;
+  MacCommandBuffer m_macCommandList;
+
+  ////////////////////////////////////////////////////////////////////
+  // Transmit queue. Only touched when the application sends faster //
+  // than the duty cycle allows.                                    //
+  ////////////////////////////////////////////////////////////////////
 
   /**
-   * The Data Rate to listen for during the second downlink transmission.
+   * Application packets waiting for the duty cycle to allow their
+   * transmission. The NEXT_TX timer is armed at the earliest time the head
+   * of the queue may be sent.
    */
-  uint8_t m_secondReceiveWindowDataRate;
+  std::deque<QueuedPacket> m_txQueue;
 
   /**
-   * The RX1DROffset parameter value
+   * Maximum number of packets in m_txQueue.
    */
-  uint8_t m_rx1DrOffset;
+  uint32_t m_maxTxQueueSize;
+
+  /**
+   * What to do with new packets when m_txQueue is full.
+   */
+  enum TxQueuePolicy m_txQueuePolicy;
+
+  /**
+   * The maximum time a payload waits for others to fill its frame.
+   */
+  Time m_maxAggregationDelay;
+
+  ///////////////////////////////////////////////////////////////
+  // Cold state: changed by MAC commands, or only used by the  //
+  // trace sources and the channel shuffle.                    //
+  ///////////////////////////////////////////////////////////////
+
+  /**
+   * The random numbers of this device, used by the Shuffle method to
+   * randomly reorder the channel list and for the ACK_TIMEOUT delay. The
+   * stream is the device address.
+   */
+  LoraCounterRng m_rng;
 
   /**
    * The last known link margin.
@@ -550,28 +897,35 @@ TracedValue<uint8_t> m_requiredTx;
   TracedValue<int> m_lastKnownGatewayCount;
 
   /**
-   * List of the MAC commands that need to be applied to the next UL packet.
+   * The aggregated duty cycle this device needs to respect across all sub-bands.
    */
-  std::list<Ptr<MacCommand> > m_macCommandList;
+  TracedValue<double> m_aggregatedDutyCycle;
 
   /**
-   * The aggregated duty cycle this device needs to respect across all sub-bands.
+   * The number of packets in the transmit queue.
    */
-  TracedValue<double> m_aggregatedDutyCycle;
+  TracedValue<uint32_t> m_txQueueDepth;
 
   /**
-   * The message type to apply to packets sent with the Send method.
+   * The trace source fired when a packet leaves the transmit queue to be
+   * sent, with the time it spent in the queue.
    */
-  LoraMacHeader::MType m_mType;
+  TracedCallback<Ptr<const Packet>, Time> m_txQueueDelay;
 
-  /* Structure containing the retransmission parameters
-   * for this device.
+  /**
+   * The trace source fired when a packet is discarded because the transmit
+   * queue is full.
    */
-  struct LoraRetxParameters m_retxParams;
+  TracedCallback<Ptr<const Packet> > m_txQueueDrop;
 
-  uint8_t m_currentFCnt;
+  /**
+   * The trace source fired when a frame carrying several application
+   * payloads is sent.
+   */
+  TracedCallback<Ptr<const Packet>, uint32_t> m_aggregatedFrame;
 
-  uint8_t m_sf;
+  static uint64_t m_nTimerEvents;           //!< Timer events scheduled so far
+  static uint64_t m_nPendingTimerEvents;    //!< Timer events in the scheduler
 
   /////////////////
   //  Callbacks  //
@@ -579,6 +933,8 @@ TracedValue<uint8_t> m_requiredTx;
 
   /**
    * The trace source fired when the transmission procedure is finished.
+   * It fires once per packet and feeds the packet tracker, so it is kept
+   * in the lean build.
    *
    * \see class CallBackTraceSource
    */
@@ -0,0 +1,318 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/energy-aware-adr-component.h"
+#include "ns3/lora-on-air-time-cache.h"
+#include "ns3/lora-tx-current-model.h"
+#include "ns3/double.h"
+#include "ns3/uinteger.h"
+#include "ns3/log.h"
+#include <limits>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("EnergyAwareAdrComponent");
+
+NS_OBJECT_ENSURE_REGISTERED (EnergyAwareAdrComponent);
+
+TypeId
+EnergyAwareAdrComponent::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::EnergyAwareAdrComponent")
+    .SetParent<NetworkControllerComponent> ()
+    .SetGroupName ("lorawan")
+    .AddConstructor<EnergyAwareAdrComponent> ()
+    .AddAttribute ("MarginDb",
+                   "Margin over the gateway sensitivity that the chosen "
+                   "settings must leave, in dB",
+                   DoubleValue (10),
+                   MakeDoubleAccessor (&EnergyAwareAdrComponent::m_marginDb),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("LowBatteryMarginDb",
+                   "Margin required for devices whose battery is low, in dB",
+                   DoubleValue (5),
+                   MakeDoubleAccessor (&EnergyAwareAdrComponent::m_lowBatteryMarginDb),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("LowBatteryThreshold",
+                   "Fraction of the battery below which a device gets the "
+                   "low battery margin",
+                   DoubleValue (0.3),
+                   MakeDoubleAccessor (&EnergyAwareAdrComponent::m_lowBatteryThreshold),
+                   MakeDoubleChecker<double> (0, 1))
+    .AddAttribute ("HistoryRange",
+                   "Number of uplinks the link budget is estimated from",
+                   UintegerValue (20),
+                   MakeUintegerAccessor (&EnergyAwareAdrComponent::m_historyRange),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("DevStatusPeriod",
+                   "Number of ADR uplinks between two DevStatusReq to the "
+                   "same device",
+                   UintegerValue (20),
+                   MakeUintegerAccessor (&EnergyAwareAdrComponent::m_devStatusPeriod),
+                   MakeUintegerChecker<uint32_t> (1))
+  ;
+  return tid;
+}
+
+EnergyAwareAdrComponent::EnergyAwareAdrComponent ()
+  : m_marginDb (10),
+  m_lowBatteryMarginDb (5),
+  m_lowBatteryThreshold (0.3),
+  m_historyRange (20),
+  m_devStatusPeriod (20)
+{
+}
+
+EnergyAwareAdrComponent::~EnergyAwareAdrComponent ()
+{
+}
+
+void
+EnergyAwareAdrComponent::OnReceivedPacket (Ptr<const Packet> packet,
+                                           Ptr<EndDeviceStatus> status,
+                                           Ptr<NetworkStatus> networkStatus)
+{
+  NS_LOG_FUNCTION (this << packet << status << networkStatus);
+
+  // Work on a copy of the packet
+  Ptr<Packet> myPacket = packet->Copy ();
+  LoraMacHeader mHdr;
+  LoraFrameHeader fHdr;
+  fHdr.SetAsUplink ();
+  myPacket->RemoveHeader (mHdr);
+  myPacket->RemoveHeader (fHdr);
+
+  DeviceRecord &record = m_devices[fHdr.GetAddress ().Get ()];
+
+  // Keep the battery level of the last DevStatusAns
+  std::list<Ptr<MacCommand> > commands = fHdr.GetCommands ();
+  for (std::list<Ptr<MacCommand> >::iterator it = commands.begin ();
+       it != commands.end (); ++it)
+    {
+      Ptr<DevStatusAns> devStatusAns = DynamicCast<DevStatusAns> (*it);
+      if (devStatusAns)
+        {
+          record.battery = devStatusAns->GetBatteryLevel ();
+          NS_LOG_DEBUG ("Battery level: " << unsigned (record.battery));
+        }
+    }
+
+  if (!fHdr.GetAdr ())
+    {
+      return;
+    }
+
+  // Keep the power received by the best gateway
+  EndDeviceStatus::ReceivedPacketInfo info = status->GetLastReceivedPacketInfo ();
+  double rxPower = -std::numeric_limits<double>::infinity ();
+  for (EndDeviceStatus::GatewayList::const_iterator it = info.gwList.begin ();
+       it != info.gwList.end (); ++it)
+    {
+      rxPower = std::max (rxPower, it->second.rxPower);
+    }
+  if (info.gwList.empty ())
+    {
+      return;
+    }
+  record.rxPowers.push_back (rxPower);
+  if (record.rxPowers.size () > m_historyRange)
+    {
+      record.rxPowers.pop_front ();
+    }
+
+  Ptr<EndDeviceLoraMac> mac = status->GetMac ();
+  bool needsReply = false;
+
+  if (++record.nSinceDevStatus >= m_devStatusPeriod)
+    {
+      record.nSinceDevStatus = 0;
+      status->m_reply.frameHeader.AddDevStatusReq ();
+      needsReply = true;
+    }
+
+  if (record.rxPowers.size () == m_historyRange)
+    {
+      double meanRxPower = 0;
+      for (std::deque<double>::const_iterator it = record.rxPowers.begin ();
+           it != record.rxPowers.end (); ++it)
+        {
+          meanRxPower += *it;
+        }
+      meanRxPower /= record.rxPowers.size ();
+
+      double txPowerDbm = mac->GetTransmissionPower ();
+      const LoraRegionProfile &region = mac->GetRegionProfile ();
+
+      // Battery levels go from 1 (empty) to 254 (full)
+      double marginDb = m_marginDb;
+      if (record.battery >= 1 && record.battery <= 254
+          && (record.battery - 1) / 253.0 < m_lowBatteryThreshold)
+        {
+          marginDb = m_lowBatteryMarginDb;
+        }
+
+      // The power is bounded by the channels the device transmits on, and
+      // the channel mask of the request keeps them as they are
+      LogicalLoraChannelHelper channelHelper = mac->GetLogicalLoraChannelHelper ();
+      std::vector<Ptr<LogicalLoraChannel> > channels = channelHelper.GetChannelList ();
+      std::list<int> enabledChannels;
+      double maxTxPowerDbm = std::numeric_limits<double>::infinity ();
+      for (std::size_t i = 0; i < channels.size (); i++)
+        {
+          if (channels[i]->IsEnabledForUplink ())
+            {
+              enabledChannels.push_back (i);
+              maxTxPowerDbm = std::min (maxTxPowerDbm,
+                                        channelHelper.GetTxPowerForChannel (channels[i]));
+            }
+        }
+
+      uint8_t newDataRate;
+      uint8_t newTxPower;
+      GetCheapestSettings (region, packet->GetSize (), meanRxPower - txPowerDbm,
+                           marginDb, maxTxPowerDbm, newDataRate, newTxPower);
+      double newTxPowerDbm = region.GetTxPowerDbm (newTxPower);
+
+      uint8_t dataRate = 0;
+      for (uint8_t dr = 0; dr < region.nUplinkDataRates; dr++)
+        {
+          if (region.GetSf (dr) == info.sf && region.GetBandwidth (dr) == 125000)
+            {
+              dataRate = dr;
+              break;
+            }
+        }
+
+      if (newDataRate != dataRate || newTxPowerDbm != txPowerDbm)
+        {
+          NS_LOG_DEBUG ("DR" << unsigned (dataRate) << " at " << txPowerDbm <<
+                        " dBm -> DR" << unsigned (newDataRate) << " at " <<
+                        newTxPowerDbm << " dBm");
+
+          status->m_reply.frameHeader.AddLinkAdrReq (newDataRate, newTxPower,
+                                                     enabledChannels, 1);
+          needsReply = true;
+        }
+    }
+
+  if (needsReply)
+    {
+      status->m_reply.frameHeader.SetAsDownlink ();
+      status->m_reply.macHeader.SetMType (LoraMacHeader::UNCONFIRMED_DATA_DOWN);
+      status->m_reply.needsReply = true;
+    }
+}
+
+void
+EnergyAwareAdrComponent::BeforeSendingReply (Ptr<EndDeviceStatus> status,
+                                             Ptr<NetworkStatus> networkStatus)
+{
+  NS_LOG_FUNCTION (this << status << networkStatus);
+}
+
+void
+EnergyAwareAdrComponent::OnFailedReply (Ptr<EndDeviceStatus> status,
+                                        Ptr<NetworkStatus> networkStatus)
+{
+  NS_LOG_FUNCTION (this << status << networkStatus);
+}
+
+void
+EnergyAwareAdrComponent::GetCheapestSettings (const LoraRegionProfile &region,
+                                              uint32_t packetSize,
+                                              double linkGainDb,
+                                              double marginDb,
+                                              double maxTxPowerDbm,
+                                              uint8_t &dataRate,
+                                              uint8_t &txPower) const
+{
+  // If no setting leaves the margin, use the most robust one: the lowest
+  // data rate at the highest power the device can use. Index 0 is the
+  // highest power of the region.
+  dataRate = 0;
+  txPower = 0;
+  while (txPower + 1 < region.nTxPowers
+         && (region.txPowerDbm[txPower] > maxTxPowerDbm
+             || !IsMeasuredTxPower (region.txPowerDbm[txPower])))
+    {
+      txPower++;
+    }
+  double minEnergy = std::numeric_limits<double>::infinity ();
+
+  for (uint8_t dr = 0; dr < region.nUplinkDataRates; dr++)
+    {
+      // The sensitivities are those of 125 kHz channels
+      if (!region.IsValidDataRate (dr) || region.GetBandwidth (dr) != 125000)
+        {
+          continue;
+        }
+
+      // The same parameters the end device MAC transmits with
+      LoraTxParameters params;
+      params.sf = region.GetSf (dr);
+      params.headerDisabled = 0;
+      params.codingRate = 1;
+      params.bandwidthHz = region.GetBandwidth (dr);
+      params.nPreamble = 8;
+      params.crcEnabled = 1;
+      params.lowDataRateOptimizationEnabled = 0;
+      double onAirTime = LoraOnAirTimeCache::GetOnAirTime (packetSize, params).GetSeconds ();
+
+      // The powers of the region, from the highest down
+      for (uint8_t index = 0; index < region.nTxPowers; index++)
+        {
+          double power = region.txPowerDbm[index];
+          if (power > maxTxPowerDbm || !IsMeasuredTxPower (power))
+            {
+              continue;
+            }
+          double margin = linkGainDb + power - GetGatewaySensitivity (params.sf);
+          if (margin < marginDb)
+            {
+              break;
+            }
+
+          // The supply voltage is the same for all settings
+          double energy = onAirTime * SX1272LoRaWANCurrentModel::GetPaBoostTxCurrent (power);
+          if (energy < minEnergy)
+            {
+              minEnergy = energy;
+              dataRate = dr;
+              txPower = index;
+            }
+        }
+    }
+}
+
+bool
+EnergyAwareAdrComponent::IsMeasuredTxPower (double txPowerDbm)
+{
+  // The PA_BOOST currents go from 2 to 20 dBm, without 18 and 19 dBm
+  return txPowerDbm >= 2 && txPowerDbm <= 20 && txPowerDbm != 18 && txPowerDbm != 19;
+}
+
+double
+EnergyAwareAdrComponent::GetGatewaySensitivity (uint8_t sf)
+{
+  // Sensitivity of the gateway for SF7 to SF12, at 125 kHz
+  static const double sensitivity[6] = {-130.0, -132.5, -135.0, -137.5, -140.0, -142.5};
+
+  return sensitivity[std::min (std::max (int (sf), 7), 12) - 7];
+}
+
+} // namespace lorawan
+} // namespace ns3
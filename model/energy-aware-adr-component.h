@@ -0,0 +1,118 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ENERGY_AWARE_ADR_COMPONENT_H
+#define ENERGY_AWARE_ADR_COMPONENT_H
+
+#include "ns3/network-controller-components.h"
+#include "ns3/end-device-status.h"
+#include "ns3/network-status.h"
+#include "ns3/lora-region-parameters.h"
+#include <deque>
+#include <map>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Network server ADR policy that minimizes the energy each uplink costs to
+ * the end device.
+ *
+ * The link budget of a device is estimated from the received power of its
+ * last HistoryRange uplinks, taking the best gateway of each. For every
+ * data rate and transmission power of the region, the component computes
+ * the margin over the gateway sensitivity and the energy of an uplink of
+ * the same size: on-air time times the TX current of the SX1272 at that
+ * power (SX1272LoRaWANCurrentModel). The cheapest setting whose margin is
+ * at least MarginDb is sent to the device with a LinkAdrReq.
+ *
+ * To extend the lifetime of the fleet, which is that of its first device to
+ * run out of energy, devices also get a DevStatusReq every DevStatusPeriod
+ * uplinks. Those whose reported battery level is below LowBatteryThreshold
+ * only need LowBatteryMarginDb, trading some reliability for cheaper
+ * uplinks.
+ */
+class EnergyAwareAdrComponent : public NetworkControllerComponent
+{
+public:
+  static TypeId GetTypeId (void);
+
+  EnergyAwareAdrComponent ();
+  virtual ~EnergyAwareAdrComponent ();
+
+  void OnReceivedPacket (Ptr<const Packet> packet,
+                         Ptr<EndDeviceStatus> status,
+                         Ptr<NetworkStatus> networkStatus);
+
+  void BeforeSendingReply (Ptr<EndDeviceStatus> status,
+                           Ptr<NetworkStatus> networkStatus);
+
+  void OnFailedReply (Ptr<EndDeviceStatus> status,
+                      Ptr<NetworkStatus> networkStatus);
+
+private:
+  /**
+   * What the component knows about an end device.
+   */
+  struct DeviceRecord
+  {
+    std::deque<double> rxPowers;    //!< Best received power of the last uplinks, in dBm
+    uint8_t battery = 255;          //!< Last DevStatusAns battery level
+    uint32_t nSinceDevStatus = 0;   //!< ADR uplinks since the last DevStatusReq
+  };
+
+  /**
+   * Pick the data rate and transmission power that minimize the energy of
+   * an uplink with the required margin.
+   *
+   * \param region The regional parameters of the device.
+   * \param packetSize The size of the PHY payload, in bytes.
+   * \param linkGainDb Received power minus transmission power, in dB.
+   * \param marginDb The required margin over the gateway sensitivity.
+   * \param maxTxPowerDbm The highest power the device may use on its
+   * channels.
+   * \param dataRate The chosen data rate.
+   * \param txPower The chosen TXPower index of the region.
+   */
+  void GetCheapestSettings (const LoraRegionProfile &region,
+                            uint32_t packetSize, double linkGainDb,
+                            double marginDb, double maxTxPowerDbm,
+                            uint8_t &dataRate, uint8_t &txPower) const;
+
+  /**
+   * Check whether the transmission current of a power is known to the
+   * SX1272 current model the energy estimates use.
+   */
+  static bool IsMeasuredTxPower (double txPowerDbm);
+
+  /**
+   * Get the sensitivity of the gateway at a spreading factor, in dBm.
+   */
+  static double GetGatewaySensitivity (uint8_t sf);
+
+  double m_marginDb;
+  double m_lowBatteryMarginDb;
+  double m_lowBatteryThreshold;
+  uint32_t m_historyRange;
+  uint32_t m_devStatusPeriod;
+
+  std::map<uint32_t, DeviceRecord> m_devices;   //!< By device address
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* ENERGY_AWARE_ADR_COMPONENT_H */
@@ -0,0 +1,338 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/fleet-periodic-sender.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/lora-packet-pool.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+#include "ns3/log.h"
+#include <algorithm>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("FleetPeriodicSender");
+
+NS_OBJECT_ENSURE_REGISTERED (FleetPeriodicSender);
+
+TypeId
+FleetPeriodicSender::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::FleetPeriodicSender")
+    .SetParent<Object> ()
+    .SetGroupName ("lorawan")
+    .AddConstructor<FleetPeriodicSender> ()
+    .AddAttribute ("Period", "The interval between packets of each device.",
+                   TimeValue (Seconds (600)),
+                   MakeTimeAccessor (&FleetPeriodicSender::SetPeriod,
+                                     &FleetPeriodicSender::GetPeriod),
+                   MakeTimeChecker ())
+    .AddAttribute ("PacketSize", "The size of the application packets.",
+                   UintegerValue (10),
+                   MakeUintegerAccessor (&FleetPeriodicSender::SetPacketSize,
+                                         &FleetPeriodicSender::GetPacketSize),
+                   MakeUintegerChecker<uint8_t> ())
+    .AddAttribute ("BucketWidth",
+                   "The time span covered by each bucket of the calendar. "
+                   "It is capped to the period.",
+                   TimeValue (Seconds (1)),
+                   MakeTimeAccessor (&FleetPeriodicSender::m_bucketWidth),
+                   MakeTimeChecker ());
+  return tid;
+}
+
+FleetPeriodicSender::FleetPeriodicSender ()
+  : m_period (Seconds (600)),
+  m_packetSize (10),
+  m_bucketWidth (Seconds (1)),
+  m_bucketWidthTs (0),
+  m_currentBucket (0),
+  m_currentBucketEnd (0),
+  m_nEntries (0),
+  m_nextDue (0),
+  m_nSent (0),
+  m_nEvents (0)
+{
+  NS_LOG_FUNCTION_NOARGS ();
+}
+
+FleetPeriodicSender::~FleetPeriodicSender ()
+{
+  NS_LOG_FUNCTION_NOARGS ();
+}
+
+void
+FleetPeriodicSender::Install (NodeContainer nodes)
+{
+  NS_LOG_FUNCTION (this);
+
+  for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+    {
+      Ptr<Node> node = *i;
+      for (uint32_t j = 0; j < node->GetNDevices (); j++)
+        {
+          Ptr<LoraNetDevice> loraNetDevice = DynamicCast<LoraNetDevice>
+              (node->GetDevice (j));
+          if (loraNetDevice)
+            {
+              Ptr<EndDeviceLoraMac> mac =
+                loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+              NS_ASSERT_MSG (mac, "Node " << node->GetId () <<
+                             " is not an end device");
+              AddDevice (mac);
+            }
+        }
+    }
+}
+
+void
+FleetPeriodicSender::AddDevice (Ptr<EndDeviceLoraMac> mac)
+{
+  NS_LOG_FUNCTION (this << mac);
+
+  m_devices.push_back (mac);
+}
+
+void
+FleetPeriodicSender::Start (Time start)
+{
+  NS_LOG_FUNCTION (this << start.GetSeconds ());
+  NS_ASSERT (m_period.IsStrictlyPositive ());
+
+  int64_t periodTs = m_period.GetTimeStep ();
+  int64_t firstTs = (Simulator::Now () + start).GetTimeStep ();
+  std::vector<CalendarEntry> entries (m_devices.size ());
+  for (uint32_t i = 0; i < m_devices.size (); i++)
+    {
+      double offset = LoraCounterRng::GetValue
+          (m_devices[i]->GetDeviceAddress ().Get (),
+          LoraCounterRng::TRAFFIC_OFFSET, 0, 0, periodTs);
+      entries[i].ts = firstTs + int64_t (offset);
+      entries[i].device = i;
+    }
+  Fill (firstTs, entries);
+}
+
+void
+FleetPeriodicSender::Resume (const std::vector<Time> &nextSendTimes)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT (nextSendTimes.size () == m_devices.size ());
+
+  int64_t nowTs = Simulator::Now ().GetTimeStep ();
+  std::vector<CalendarEntry> entries;
+  for (uint32_t i = 0; i < m_devices.size (); i++)
+    {
+      if (nextSendTimes[i] != Time::Max ())
+        {
+          CalendarEntry entry;
+          entry.ts = nowTs + std::max<int64_t> (nextSendTimes[i].GetTimeStep (), 0);
+          entry.device = i;
+          entries.push_back (entry);
+        }
+    }
+  Fill (nowTs, entries);
+}
+
+void
+FleetPeriodicSender::GetNextSendTimes (std::vector<Time> &nextSendTimes) const
+{
+  nextSendTimes.assign (m_devices.size (), Time::Max ());
+  int64_t nowTs = Simulator::Now ().GetTimeStep ();
+  for (std::size_t i = 0; i < m_buckets.size (); i++)
+    {
+      for (std::size_t j = 0; j < m_buckets[i].size (); j++)
+        {
+          nextSendTimes[m_buckets[i][j].device] = TimeStep (m_buckets[i][j].ts - nowTs);
+        }
+    }
+  for (std::size_t j = m_nextDue; j < m_due.size (); j++)
+    {
+      nextSendTimes[m_due[j].device] = TimeStep (m_due[j].ts - nowTs);
+    }
+}
+
+void
+FleetPeriodicSender::Fill (int64_t firstTs, const std::vector<CalendarEntry> &entries)
+{
+  NS_ASSERT (m_period.IsStrictlyPositive ());
+  NS_ASSERT (m_bucketWidth.IsStrictlyPositive ());
+
+  Stop ();
+
+  int64_t periodTs = m_period.GetTimeStep ();
+  m_bucketWidthTs = std::min (m_bucketWidth.GetTimeStep (), periodTs);
+
+  // The buckets must cover at least one period, so that each entry is
+  // reinserted at most one round ahead
+  uint32_t nBuckets = (periodTs + m_bucketWidthTs - 1) / m_bucketWidthTs;
+  m_buckets.assign (nBuckets, std::vector<CalendarEntry> ());
+
+  for (std::size_t i = 0; i < entries.size (); i++)
+    {
+      Insert (entries[i]);
+    }
+  m_nEntries = entries.size ();
+
+  // Position the calendar just before the bucket of the start time
+  m_currentBucketEnd = (firstTs / m_bucketWidthTs) * m_bucketWidthTs;
+  m_currentBucket = (firstTs / m_bucketWidthTs + nBuckets - 1) % nBuckets;
+
+  NS_LOG_INFO ("Serving " << m_nEntries << " devices with " << nBuckets <<
+               " buckets");
+
+  ScheduleNext ();
+}
+
+void
+FleetPeriodicSender::Stop (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  Simulator::Cancel (m_event);
+  m_buckets.clear ();
+  m_due.clear ();
+  m_nextDue = 0;
+  m_nEntries = 0;
+}
+
+void
+FleetPeriodicSender::Insert (CalendarEntry entry)
+{
+  m_buckets[(entry.ts / m_bucketWidthTs) % m_buckets.size ()].push_back (entry);
+}
+
+void
+FleetPeriodicSender::ScheduleNext (void)
+{
+  if (m_nEntries == 0)
+    {
+      return;
+    }
+
+  while (m_nextDue == m_due.size ())
+    {
+      m_due.clear ();
+      m_nextDue = 0;
+      m_currentBucket = (m_currentBucket + 1) % m_buckets.size ();
+      m_currentBucketEnd += m_bucketWidthTs;
+
+      // Take the entries of this round, leaving those of later rounds in the
+      // bucket
+      std::vector<CalendarEntry> &bucket = m_buckets[m_currentBucket];
+      std::size_t nKept = 0;
+      for (std::size_t i = 0; i < bucket.size (); i++)
+        {
+          if (bucket[i].ts < m_currentBucketEnd)
+            {
+              m_due.push_back (bucket[i]);
+            }
+          else
+            {
+              bucket[nKept++] = bucket[i];
+            }
+        }
+      bucket.resize (nKept);
+      std::sort (m_due.begin (), m_due.end ());
+    }
+
+  m_event = Simulator::Schedule (TimeStep (m_due[m_nextDue].ts) - Simulator::Now (),
+                                 &FleetPeriodicSender::Fire, this);
+  m_nEvents++;
+}
+
+void
+FleetPeriodicSender::Fire (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  int64_t nowTs = Simulator::Now ().GetTimeStep ();
+  int64_t periodTs = m_period.GetTimeStep ();
+
+  while (m_nextDue < m_due.size () && m_due[m_nextDue].ts <= nowTs)
+    {
+      CalendarEntry entry = m_due[m_nextDue++];
+
+      // Devices that ran out of energy leave the calendar for good
+      if (m_devices[entry.device]->IsQuiesced ())
+        {
+          NS_LOG_DEBUG ("Device " << entry.device << " is quiesced");
+          m_nEntries--;
+          continue;
+        }
+
+      NS_LOG_DEBUG ("Sending a packet for device " << entry.device);
+      m_devices[entry.device]->Send (LoraPacketPool::Acquire (m_packetSize));
+      m_nSent++;
+
+      // The period is not shorter than a bucket, so the entry always goes
+      // to a later bucket or round
+      entry.ts += periodTs;
+      Insert (entry);
+    }
+
+  ScheduleNext ();
+}
+
+void
+FleetPeriodicSender::SetPeriod (Time period)
+{
+  NS_LOG_FUNCTION (this << period.GetSeconds ());
+
+  m_period = period;
+}
+
+Time
+FleetPeriodicSender::GetPeriod (void) const
+{
+  return m_period;
+}
+
+void
+FleetPeriodicSender::SetPacketSize (uint8_t size)
+{
+  NS_LOG_FUNCTION (this << unsigned (size));
+
+  m_packetSize = size;
+}
+
+uint8_t
+FleetPeriodicSender::GetPacketSize (void) const
+{
+  return m_packetSize;
+}
+
+uint32_t
+FleetPeriodicSender::GetNDevices (void) const
+{
+  return m_devices.size ();
+}
+
+uint64_t
+FleetPeriodicSender::GetNSent (void) const
+{
+  return m_nSent;
+}
+
+uint64_t
+FleetPeriodicSender::GetNEvents (void) const
+{
+  return m_nEvents;
+}
+
+} // namespace lorawan
+} // namespace ns3
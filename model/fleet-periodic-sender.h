@@ -0,0 +1,190 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef FLEET_PERIODIC_SENDER_H
+#define FLEET_PERIODIC_SENDER_H
+
+#include "ns3/object.h"
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+#include "ns3/node-container.h"
+#include "ns3/lora-counter-rng.h"
+#include "ns3/end-device-lora-mac.h"
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Periodic traffic generator for a whole fleet of end devices.
+ *
+ * Installing a PeriodicSender on every device keeps one application object
+ * and one pending simulator event per device. This class drives all the
+ * devices from a single event instead: the next send time of each device is
+ * kept in a calendar of fixed-width time buckets, and packets are handed to
+ * EndDeviceLoraMac::Send directly, in time order. Packets come from the
+ * LoraPacketPool.
+ *
+ * As with the PeriodicSenderHelper, the first packet of each device is sent
+ * at a random offset within the first period. The offset is drawn from the
+ * device's LoraCounterRng stream, so it does not depend on the order in
+ * which devices are added. Devices that are quiesced (see
+ * EndDeviceLoraMac::Quiesce) leave the calendar at their next send time.
+ */
+class FleetPeriodicSender : public Object
+{
+public:
+  static TypeId GetTypeId (void);
+
+  FleetPeriodicSender ();
+  virtual ~FleetPeriodicSender ();
+
+  /**
+   * Add the end devices of the nodes to the fleet.
+   *
+   * \param nodes The nodes, each with a LoraNetDevice with an
+   * EndDeviceLoraMac.
+   */
+  void Install (NodeContainer nodes);
+
+  /**
+   * Add an end device to the fleet.
+   */
+  void AddDevice (Ptr<EndDeviceLoraMac> mac);
+
+  /**
+   * Start generating traffic. Devices added after this call are not served.
+   *
+   * \param start The time at which the first period begins.
+   */
+  void Start (Time start);
+
+  /**
+   * Start generating traffic from saved send times, e.g., to resume a run.
+   *
+   * \param nextSendTimes The delay before the next packet of each device, in
+   * the order they were added, or Time::Max () for devices that are not
+   * served anymore.
+   */
+  void Resume (const std::vector<Time> &nextSendTimes);
+
+  /**
+   * Get the delay before the next packet of each device, in the order they
+   * were added, or Time::Max () for devices that are not served.
+   */
+  void GetNextSendTimes (std::vector<Time> &nextSendTimes) const;
+
+  /**
+   * Stop generating traffic.
+   */
+  void Stop (void);
+
+  void SetPeriod (Time period);
+  Time GetPeriod (void) const;
+
+  void SetPacketSize (uint8_t size);
+  uint8_t GetPacketSize (void) const;
+
+  /**
+   * \return The number of devices in the fleet.
+   */
+  uint32_t GetNDevices (void) const;
+
+  /**
+   * \return The number of packets handed to the MAC so far.
+   */
+  uint64_t GetNSent (void) const;
+
+  /**
+   * \return The number of simulator events scheduled so far.
+   */
+  uint64_t GetNEvents (void) const;
+
+private:
+  /**
+   * The next send time of a device.
+   */
+  struct CalendarEntry
+  {
+    int64_t ts;            //!< The send time, in time steps
+    uint32_t device;       //!< The index of the device in m_devices
+
+    bool
+    operator< (const CalendarEntry &other) const
+    {
+      return ts < other.ts || (ts == other.ts && device < other.device);
+    }
+  };
+
+  /**
+   * Fill the calendar with the first send time of each device, and
+   * schedule the first event.
+   *
+   * \param firstTs The earliest send time, in time steps.
+   * \param entries The entries.
+   */
+  void Fill (int64_t firstTs, const std::vector<CalendarEntry> &entries);
+
+  /**
+   * Add an entry to the bucket that covers its send time.
+   */
+  void Insert (CalendarEntry entry);
+
+  /**
+   * Move to the next entry in time order, loading the next non-empty bucket
+   * if needed, and schedule the event for it.
+   */
+  void ScheduleNext (void);
+
+  /**
+   * Send a packet for all the devices that are due now.
+   */
+  void Fire (void);
+
+  Time m_period;
+  uint8_t m_packetSize;
+  Time m_bucketWidth;
+
+  std::vector<Ptr<EndDeviceLoraMac> > m_devices;
+
+  /**
+   * The calendar: bucket i holds the entries whose send time falls in
+   * [k * width * nBuckets + i * width, k * width * nBuckets + (i + 1) * width)
+   * for some k. Entries are not sorted within a bucket.
+   */
+  std::vector<std::vector<CalendarEntry> > m_buckets;
+
+  int64_t m_bucketWidthTs;           //!< The bucket width, in time steps
+  uint32_t m_currentBucket;          //!< The bucket m_due was loaded from
+  int64_t m_currentBucketEnd;        //!< End of the current bucket, in time steps
+  uint64_t m_nEntries;               //!< Entries in the calendar and in m_due
+
+  /**
+   * The sorted entries of the current bucket, and the index of the next one
+   * to fire.
+   */
+  std::vector<CalendarEntry> m_due;
+  std::size_t m_nextDue;
+
+  EventId m_event;
+  uint64_t m_nSent;
+  uint64_t m_nEvents;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* FLEET_PERIODIC_SENDER_H */
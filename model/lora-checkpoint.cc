@@ -0,0 +1,437 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-checkpoint.h"
+#include "ns3/lora-result-cache.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/basic-energy-source.h"
+#include "ns3/double.h"
+#include "ns3/simulator.h"
+#include "ns3/log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraCheckpoint");
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = {'L', 'O', 'R', 'A', 'C', 'K', 'P', '2'};
+
+// Flags of a device record
+const uint8_t WAITING_ACK = 1;
+const uint8_t RETX_PENDING = 2;
+const uint8_t QUIESCED = 4;
+const uint8_t RETX_PACKET = 8;
+
+// What a checkpoint holds for a device, besides the MAC state
+struct DeviceRecord
+{
+  double energyConsumption;
+  int64_t depletionTs;       // In the time of the original run
+  int64_t nextSendTs;        // Relative to the checkpoint
+};
+
+template <typename T>
+void
+Put (std::vector<char> &buffer, T value)
+{
+  const char *bytes = reinterpret_cast<const char *> (&value);
+  buffer.insert (buffer.end (), bytes, bytes + sizeof (T));
+}
+
+template <typename T>
+bool
+Get (const char *&cursor, const char *end, T &value)
+{
+  if (end - cursor < ssize_t (sizeof (T)))
+    {
+      return false;
+    }
+  std::memcpy (&value, cursor, sizeof (T));
+  cursor += sizeof (T);
+  return true;
+}
+
+void
+PutPacket (std::vector<char> &buffer, Ptr<const Packet> packet, Time time)
+{
+  uint16_t size = packet->GetSize ();
+  Put (buffer, size);
+  Put (buffer, time.GetTimeStep ());
+  std::size_t offset = buffer.size ();
+  buffer.resize (offset + size);
+  packet->CopyData (reinterpret_cast<uint8_t *> (buffer.data () + offset), size);
+}
+
+bool
+GetPacket (const char *&cursor, const char *end, Ptr<Packet> &packet, Time &time)
+{
+  uint16_t size;
+  int64_t ts;
+  if (!Get (cursor, end, size) || !Get (cursor, end, ts) || end - cursor < size)
+    {
+      return false;
+    }
+  packet = Create<Packet> (reinterpret_cast<const uint8_t *> (cursor), size);
+  time = TimeStep (ts);
+  cursor += size;
+  return true;
+}
+
+// Read the record of a device
+bool
+GetDevice (const char *&cursor, const char *end, DeviceRecord &record,
+           EndDeviceLoraMac::SavedState &state)
+{
+  uint8_t flags;
+  int64_t nextTxTs;
+  int64_t retxFirstAttemptTs;
+  uint8_t nChannels;
+  uint8_t nPackets;
+  bool ok = Get (cursor, end, record.energyConsumption)
+    && Get (cursor, end, record.depletionTs)
+    && Get (cursor, end, record.nextSendTs)
+    && Get (cursor, end, state.nDraws)
+    && Get (cursor, end, state.txPower)
+    && Get (cursor, end, state.aggregatedDutyCycle)
+    && Get (cursor, end, nextTxTs)
+    && Get (cursor, end, retxFirstAttemptTs)
+    && Get (cursor, end, state.dataRate)
+    && Get (cursor, end, state.sf)
+    && Get (cursor, end, state.fCnt)
+    && Get (cursor, end, state.retxLeft)
+    && Get (cursor, end, flags)
+    && Get (cursor, end, nChannels);
+  if (!ok)
+    {
+      return false;
+    }
+  state.nextTx = TimeStep (nextTxTs);
+  state.retxFirstAttempt = TimeStep (retxFirstAttemptTs);
+  state.waitingAck = flags & WAITING_ACK;
+  state.retxPending = flags & RETX_PENDING;
+  state.quiesced = flags & QUIESCED;
+
+  state.channelWaitingTimes.resize (nChannels);
+  for (uint8_t i = 0; i < nChannels; i++)
+    {
+      int64_t ts;
+      if (!Get (cursor, end, ts))
+        {
+          return false;
+        }
+      state.channelWaitingTimes[i] = TimeStep (ts);
+    }
+
+  Time time;
+  state.retxPacket = 0;
+  if ((flags & RETX_PACKET) && !GetPacket (cursor, end, state.retxPacket, time))
+    {
+      return false;
+    }
+  if (!Get (cursor, end, nPackets))
+    {
+      return false;
+    }
+  state.txQueue.resize (nPackets);
+  for (uint8_t i = 0; i < nPackets; i++)
+    {
+      if (!GetPacket (cursor, end, state.txQueue[i].first, state.txQueue[i].second))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+} // namespace
+
+LoraCheckpoint::LoraCheckpoint ()
+  : m_configHash (0),
+  m_timeOffset (Seconds (0)),
+  m_interval (Seconds (0)),
+  m_nSaved (0)
+{
+}
+
+LoraCheckpoint::~LoraCheckpoint ()
+{
+  m_event.Cancel ();
+}
+
+void
+LoraCheckpoint::SetDevices (NodeContainer nodes, EnergySourceContainer sources,
+                            DeviceEnergyModelContainer models,
+                            Ptr<FleetPeriodicSender> sender)
+{
+  NS_LOG_FUNCTION (this);
+
+  m_macs.clear ();
+  for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+    {
+      Ptr<Node> node = *i;
+      for (uint32_t j = 0; j < node->GetNDevices (); j++)
+        {
+          Ptr<LoraNetDevice> loraNetDevice = DynamicCast<LoraNetDevice>
+              (node->GetDevice (j));
+          if (loraNetDevice)
+            {
+              Ptr<EndDeviceLoraMac> mac =
+                loraNetDevice->GetMac ()->GetObject<EndDeviceLoraMac> ();
+              NS_ASSERT_MSG (mac, "Node " << node->GetId () <<
+                             " is not an end device");
+              m_macs.push_back (mac);
+            }
+        }
+    }
+  NS_ASSERT (sources.GetN () == m_macs.size () && models.GetN () == m_macs.size ());
+  NS_ASSERT (sender && sender->GetNDevices () == m_macs.size ());
+
+  m_sources = sources;
+  m_models = models;
+  m_sender = sender;
+}
+
+void
+LoraCheckpoint::SetConfig (const std::string &config)
+{
+  m_configHash = LoraResultCache::Hash (config);
+}
+
+void
+LoraCheckpoint::Schedule (Time interval, const std::string &fileName)
+{
+  NS_LOG_FUNCTION (this << interval << fileName);
+  NS_ASSERT (interval.IsStrictlyPositive ());
+
+  m_interval = interval;
+  m_fileName = fileName;
+  m_event.Cancel ();
+  m_event = Simulator::Schedule (m_interval, &LoraCheckpoint::Checkpoint, this);
+}
+
+void
+LoraCheckpoint::Checkpoint (void)
+{
+  Save (m_fileName);
+  m_event = Simulator::Schedule (m_interval, &LoraCheckpoint::Checkpoint, this);
+}
+
+bool
+LoraCheckpoint::Save (const std::string &fileName)
+{
+  NS_LOG_FUNCTION (this << fileName);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+
+  std::vector<Time> nextSendTimes;
+  m_sender->GetNextSendTimes (nextSendTimes);
+
+  // The whole checkpoint is built in memory, about a hundred bytes per
+  // device, and written with a single call
+  m_buffer.clear ();
+  m_buffer.reserve (64 + m_macs.size () * 128);
+  m_buffer.insert (m_buffer.end (), CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + sizeof (CHECKPOINT_MAGIC));
+  Put (m_buffer, m_configHash);
+  Put (m_buffer, (m_timeOffset + Simulator::Now ()).GetTimeStep ());
+  Put (m_buffer, uint32_t (m_macs.size ()));
+
+  EndDeviceLoraMac::SavedState state;
+  for (uint32_t i = 0; i < m_macs.size (); i++)
+    {
+      Ptr<LoraRadioEnergyModel> model = DynamicCast<LoraRadioEnergyModel> (m_models.Get (i));
+      NS_ASSERT (model);
+      m_macs[i]->SaveState (state);
+
+      Put (m_buffer, model->GetEnergyConsumptionToDate ());
+      Put (m_buffer, model->IsDepleted () ?
+           (m_timeOffset + model->GetDepletionTime ()).GetTimeStep () :
+           Time::Max ().GetTimeStep ());
+      Put (m_buffer, nextSendTimes[i].GetTimeStep ());
+      Put (m_buffer, state.nDraws);
+      Put (m_buffer, state.txPower);
+      Put (m_buffer, state.aggregatedDutyCycle);
+      Put (m_buffer, state.nextTx.GetTimeStep ());
+      Put (m_buffer, state.retxFirstAttempt.GetTimeStep ());
+      Put (m_buffer, state.dataRate);
+      Put (m_buffer, state.sf);
+      Put (m_buffer, state.fCnt);
+      Put (m_buffer, state.retxLeft);
+      Put (m_buffer, uint8_t ((state.waitingAck ? WAITING_ACK : 0) |
+                              (state.retxPending ? RETX_PENDING : 0) |
+                              (state.quiesced ? QUIESCED : 0) |
+                              (state.retxPacket ? RETX_PACKET : 0)));
+      Put (m_buffer, uint8_t (state.channelWaitingTimes.size ()));
+      for (std::size_t j = 0; j < state.channelWaitingTimes.size (); j++)
+        {
+          Put (m_buffer, state.channelWaitingTimes[j].GetTimeStep ());
+        }
+      if (state.retxPacket)
+        {
+          PutPacket (m_buffer, state.retxPacket, Seconds (0));
+        }
+      Put (m_buffer, uint8_t (state.txQueue.size ()));
+      for (std::size_t j = 0; j < state.txQueue.size (); j++)
+        {
+          PutPacket (m_buffer, state.txQueue[j].first, state.txQueue[j].second);
+        }
+    }
+
+  // Readers and a later resume see either the previous checkpoint or this
+  // one, never part of it
+  std::string temporary = fileName + ".tmp";
+  int fd = open (temporary.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0;
+  std::size_t written = 0;
+  while (ok && written < m_buffer.size ())
+    {
+      ssize_t n = write (fd, m_buffer.data () + written, m_buffer.size () - written);
+      ok = n > 0;
+      written += ok ? n : 0;
+    }
+  if (fd >= 0)
+    {
+      ok = close (fd) == 0 && ok;
+    }
+  ok = ok && std::rename (temporary.c_str (), fileName.c_str ()) == 0;
+  if (!ok)
+    {
+      NS_LOG_WARN ("Cannot write the checkpoint " << fileName);
+      std::remove (temporary.c_str ());
+      return false;
+    }
+
+  m_nSaved++;
+  NS_LOG_INFO ("Checkpoint at " << (m_timeOffset + Simulator::Now ()).GetSeconds () <<
+               " s: " << m_buffer.size () << " bytes in " <<
+               std::chrono::duration<double>
+                 (std::chrono::steady_clock::now () - start).count () << " s");
+  return true;
+}
+
+bool
+LoraCheckpoint::Restore (const std::string &fileName)
+{
+  NS_LOG_FUNCTION (this << fileName);
+
+  int fd = open (fileName.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  m_buffer.clear ();
+  char chunk[1 << 16];
+  ssize_t n;
+  while ((n = read (fd, chunk, sizeof (chunk))) > 0)
+    {
+      m_buffer.insert (m_buffer.end (), chunk, chunk + n);
+    }
+  close (fd);
+
+  const char *begin = m_buffer.data ();
+  const char *end = begin + m_buffer.size ();
+  const char *cursor = begin;
+  uint64_t configHash;
+  int64_t timeTs;
+  uint32_t nDevices;
+  if (m_buffer.size () < sizeof (CHECKPOINT_MAGIC)
+      || std::memcmp (begin, CHECKPOINT_MAGIC, sizeof (CHECKPOINT_MAGIC)) != 0)
+    {
+      NS_LOG_WARN (fileName << " is not a checkpoint");
+      return false;
+    }
+  cursor += sizeof (CHECKPOINT_MAGIC);
+  if (!Get (cursor, end, configHash) || !Get (cursor, end, timeTs)
+      || !Get (cursor, end, nDevices) || configHash != m_configHash
+      || nDevices != m_macs.size ())
+    {
+      NS_LOG_WARN ("The checkpoint " << fileName << " is from another configuration");
+      return false;
+    }
+  const char *devices = cursor;
+
+  // Check the whole file before touching any device
+  DeviceRecord record;
+  EndDeviceLoraMac::SavedState state;
+  for (uint32_t i = 0; i < nDevices; i++)
+    {
+      if (!GetDevice (cursor, end, record, state))
+        {
+          NS_LOG_WARN ("The checkpoint " << fileName << " is truncated");
+          return false;
+        }
+    }
+
+  m_timeOffset = TimeStep (timeTs);
+  std::vector<Time> nextSendTimes (nDevices);
+  cursor = devices;
+  for (uint32_t i = 0; i < nDevices; i++)
+    {
+      GetDevice (cursor, end, record, state);
+
+      // The source starts with the energy that was left. Its depletion
+      // threshold is a fraction of its initial energy, so the fraction is
+      // scaled to keep the threshold where it was.
+      Ptr<BasicEnergySource> source = DynamicCast<BasicEnergySource> (m_sources.Get (i));
+      if (source && record.energyConsumption > 0)
+        {
+          double initialEnergy = source->GetInitialEnergy ();
+          double remainingEnergy = std::max (initialEnergy - record.energyConsumption,
+                                             initialEnergy * 1e-9);
+          DoubleValue threshold;
+          source->GetAttribute ("BasicEnergyLowBatteryThreshold", threshold);
+          source->SetInitialEnergy (remainingEnergy);
+          source->SetAttribute ("BasicEnergyLowBatteryThreshold", DoubleValue
+                                  (std::min (threshold.Get () * initialEnergy / remainingEnergy,
+                                             1.0)));
+        }
+
+      Ptr<LoraRadioEnergyModel> model = DynamicCast<LoraRadioEnergyModel> (m_models.Get (i));
+      NS_ASSERT (model);
+      model->RestoreEnergyConsumption
+        (record.energyConsumption, record.depletionTs == Time::Max ().GetTimeStep () ?
+         Time::Max () : TimeStep (record.depletionTs) - m_timeOffset);
+
+      m_macs[i]->RestoreState (state);
+      nextSendTimes[i] = TimeStep (record.nextSendTs);
+    }
+  m_sender->Resume (nextSendTimes);
+
+  NS_LOG_INFO ("Resumed from the checkpoint at " << m_timeOffset.GetSeconds () << " s");
+  return true;
+}
+
+Time
+LoraCheckpoint::GetTimeOffset (void) const
+{
+  return m_timeOffset;
+}
+
+uint32_t
+LoraCheckpoint::GetNSaved (void) const
+{
+  return m_nSaved;
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,136 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_CHECKPOINT_H
+#define LORA_CHECKPOINT_H
+
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+#include "ns3/node-container.h"
+#include "ns3/energy-source-container.h"
+#include "ns3/device-energy-model-container.h"
+#include "ns3/end-device-lora-mac.h"
+#include "ns3/lora-radio-energy-model.h"
+#include "ns3/fleet-periodic-sender.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Periodic checkpoints of the end devices of a run, and resumption of the
+ * run from the last one.
+ *
+ * A checkpoint holds, for each device, the energy consumed so far and the
+ * depletion time, the MAC state (see EndDeviceLoraMac::SavedState: data
+ * rate, power, frame counter, duty cycle, retransmission procedure,
+ * transmit queue, draw counters of the LoraCounterRng streams) and the
+ * next send time of the FleetPeriodicSender. It is written at once to a
+ * binary file, through a temporary file and a rename, so that the file
+ * always holds a complete checkpoint.
+ *
+ * A run is resumed in a new process, which builds the same scenario and
+ * then calls Restore before Simulator::Run. The simulator clock starts
+ * over at 0: the resumed run simulates what was left after the checkpoint,
+ * and GetTimeOffset tells how far in the original run its time 0 is.
+ * Energy sources are given the energy that was left, and depleted devices
+ * are depleted again, at their original depletion time.
+ *
+ * The rest of the scenario is not saved: the state of the gateways and the
+ * network server, the ns-3 random variable streams (e.g., of the
+ * shadowing) and the packet tracker start over. A resumed run thus
+ * follows the same scenario and the same device random numbers, but is
+ * not identical to a run that was never interrupted.
+ */
+class LoraCheckpoint
+{
+public:
+  LoraCheckpoint ();
+  ~LoraCheckpoint ();
+
+  /**
+   * Set the devices to checkpoint.
+   *
+   * \param nodes The end device nodes.
+   * \param sources The energy sources of the nodes, in the same order.
+   * \param models The radio energy models of the nodes, in the same order.
+   * \param sender The traffic generator of the nodes.
+   */
+  void SetDevices (NodeContainer nodes, EnergySourceContainer sources,
+                   DeviceEnergyModelContainer models, Ptr<FleetPeriodicSender> sender);
+
+  /**
+   * Set the configuration of the run. A checkpoint is only restored in a
+   * run with the same configuration.
+   */
+  void SetConfig (const std::string &config);
+
+  /**
+   * Write a checkpoint every interval of simulated time.
+   */
+  void Schedule (Time interval, const std::string &fileName);
+
+  /**
+   * Write a checkpoint now.
+   *
+   * \return Whether the checkpoint was written.
+   */
+  bool Save (const std::string &fileName);
+
+  /**
+   * Restore a checkpoint, before Simulator::Run, and start the traffic.
+   *
+   * \return Whether the checkpoint was restored. If it was not, nothing
+   * changed.
+   */
+  bool Restore (const std::string &fileName);
+
+  /**
+   * \return The time of the original run at which this run started: 0, or
+   * the time of the restored checkpoint.
+   */
+  Time GetTimeOffset (void) const;
+
+  /**
+   * \return The number of checkpoints written.
+   */
+  uint32_t GetNSaved (void) const;
+
+private:
+  /**
+   * Write a checkpoint and schedule the next one.
+   */
+  void Checkpoint (void);
+
+  std::vector<Ptr<EndDeviceLoraMac> > m_macs;
+  EnergySourceContainer m_sources;
+  DeviceEnergyModelContainer m_models;
+  Ptr<FleetPeriodicSender> m_sender;
+  uint64_t m_configHash;
+  Time m_timeOffset;
+  Time m_interval;
+  std::string m_fileName;
+  EventId m_event;
+  uint32_t m_nSaved;
+  std::vector<char> m_buffer;     //!< The checkpoint being written or read
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_CHECKPOINT_H */
@@ -0,0 +1,133 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-counter-rng.h"
+#include "ns3/rng-seed-manager.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraCounterRng");
+
+// Philox4x32 multipliers and Weyl sequence constants
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+LoraCounterRng::Key LoraCounterRng::m_key = {{0, 0}};
+bool LoraCounterRng::m_keySet = false;
+
+LoraCounterRng::LoraCounterRng ()
+  : m_stream (0)
+{
+  m_nDraws.fill (0);
+}
+
+void
+LoraCounterRng::SetStream (uint32_t stream)
+{
+  m_stream = stream;
+}
+
+uint32_t
+LoraCounterRng::GetStream (void) const
+{
+  return m_stream;
+}
+
+double
+LoraCounterRng::GetValue (Purpose purpose, double min, double max)
+{
+  return GetValue (m_stream, purpose, m_nDraws[purpose]++, min, max);
+}
+
+uint32_t
+LoraCounterRng::GetNDraws (Purpose purpose) const
+{
+  return m_nDraws[purpose];
+}
+
+void
+LoraCounterRng::SetNDraws (Purpose purpose, uint32_t nDraws)
+{
+  m_nDraws[purpose] = nDraws;
+}
+
+double
+LoraCounterRng::GetValue (uint32_t stream, Purpose purpose, uint32_t draw,
+                          double min, double max)
+{
+  Counter counter = {{draw, 0, stream, uint32_t (purpose)}};
+  Counter block = Philox4x32 (counter, GetKey ());
+
+  // Use 53 bits of the block for a double in [0, 1)
+  double u = ((block[0] >> 5) * 67108864.0 + (block[1] >> 6))
+    / 9007199254740992.0;
+  return min + u * (max - min);
+}
+
+void
+LoraCounterRng::SetKey (uint32_t seed, uint64_t run)
+{
+  NS_LOG_FUNCTION (seed << run);
+
+  // Known-answer check of the block function (Random123 test vector)
+  NS_ASSERT (Philox4x32 (Counter {{0, 0, 0, 0}}, Key {{0, 0}})
+             == (Counter {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}}));
+
+  m_key[0] = seed;
+  m_key[1] = uint32_t (run) ^ uint32_t (run >> 32);
+  m_keySet = true;
+}
+
+LoraCounterRng::Key
+LoraCounterRng::GetKey (void)
+{
+  if (!m_keySet)
+    {
+      SetKey (RngSeedManager::GetSeed (), RngSeedManager::GetRun ());
+    }
+  return m_key;
+}
+
+LoraCounterRng::Counter
+LoraCounterRng::Philox4x32 (Counter counter, Key key)
+{
+  for (int round = 0; round < 10; round++)
+    {
+      if (round > 0)
+        {
+          key[0] += PHILOX_W0;
+          key[1] += PHILOX_W1;
+        }
+
+      uint64_t product0 = uint64_t (PHILOX_M0) * counter[0];
+      uint64_t product1 = uint64_t (PHILOX_M1) * counter[2];
+
+      Counter next;
+      next[0] = uint32_t (product1 >> 32) ^ counter[1] ^ key[0];
+      next[1] = uint32_t (product1);
+      next[2] = uint32_t (product0 >> 32) ^ counter[3] ^ key[1];
+      next[3] = uint32_t (product0);
+      counter = next;
+    }
+  return counter;
+}
+
+} // namespace lorawan
+} // namespace ns3
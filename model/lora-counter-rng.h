@@ -0,0 +1,122 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_COUNTER_RNG_H
+#define LORA_COUNTER_RNG_H
+
+#include <stdint.h>
+#include <array>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Counter-based random numbers for end devices.
+ *
+ * Draws are computed with the Philox4x32-10 generator (Salmon et al.,
+ * "Parallel random numbers: as easy as 1, 2, 3", SC'11). The key is the
+ * global seed and run number, and the counter is made of the draw index,
+ * the stream (the device address) and the purpose of the draw. A draw thus
+ * only depends on which device makes it, what for, and how many draws of
+ * that kind the device made before. It does not depend on the order in
+ * which devices were installed, or on how they are split across processes.
+ *
+ * A device only stores its stream and one draw counter per purpose; the
+ * generator itself is a pure function.
+ */
+class LoraCounterRng
+{
+public:
+  /**
+   * What a random number is drawn for. Each purpose has its own sequence.
+   */
+  enum Purpose
+  {
+    CHANNEL_SHUFFLE,
+    ACK_TIMEOUT,
+    TRAFFIC_OFFSET,
+    N_PURPOSES
+  };
+
+  typedef std::array<uint32_t, 4> Counter;
+  typedef std::array<uint32_t, 2> Key;
+
+  LoraCounterRng ();
+
+  /**
+   * Set the stream of this generator, usually the device address.
+   */
+  void SetStream (uint32_t stream);
+
+  uint32_t GetStream (void) const;
+
+  /**
+   * Draw the next value of a sequence, uniformly distributed in
+   * [min, max).
+   */
+  double GetValue (Purpose purpose, double min, double max);
+
+  /**
+   * Get the number of values drawn so far for a purpose.
+   */
+  uint32_t GetNDraws (Purpose purpose) const;
+
+  /**
+   * Set the number of values drawn so far for a purpose, e.g., to resume a
+   * sequence.
+   */
+  void SetNDraws (Purpose purpose, uint32_t nDraws);
+
+  /**
+   * Compute a value of a sequence, uniformly distributed in [min, max).
+   *
+   * \param stream The stream, usually the device address.
+   * \param purpose The purpose of the draw.
+   * \param draw The index of the value in the sequence.
+   * \param min The lower bound.
+   * \param max The upper bound.
+   */
+  static double GetValue (uint32_t stream, Purpose purpose, uint32_t draw,
+                          double min, double max);
+
+  /**
+   * Set the key of all sequences. By default, the key is taken from the
+   * RngSeedManager seed and run number the first time a value is drawn.
+   */
+  static void SetKey (uint32_t seed, uint64_t run);
+
+  /**
+   * Get the key of all sequences.
+   */
+  static Key GetKey (void);
+
+  /**
+   * The Philox4x32 block function, with 10 rounds.
+   */
+  static Counter Philox4x32 (Counter counter, Key key);
+
+private:
+  uint32_t m_stream;
+  std::array<uint32_t, N_PURPOSES> m_nDraws;
+
+  static Key m_key;
+  static bool m_keySet;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_COUNTER_RNG_H */
@@ -0,0 +1,136 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-on-air-time-cache.h"
+#include "ns3/packet.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraOnAirTimeCache");
+
+uint64_t LoraOnAirTimeCache::m_nHits = 0;
+uint64_t LoraOnAirTimeCache::m_nMisses = 0;
+
+std::unordered_map<uint64_t, Time> &
+LoraOnAirTimeCache::GetTable (void)
+{
+  static std::unordered_map<uint64_t, Time> table;
+  return table;
+}
+
+uint64_t
+LoraOnAirTimeCache::GetKey (uint32_t payloadSize, const LoraTxParameters &params)
+{
+  NS_ASSERT (payloadSize < (1 << 16));
+  NS_ASSERT (params.nPreamble < (1 << 16));
+  NS_ASSERT (params.sf < (1 << 4));
+  NS_ASSERT (params.codingRate < (1 << 3));
+  NS_ASSERT (params.bandwidthHz < (1 << 20));
+
+  // | size:16 | preamble:16 | bandwidth:20 | sf:4 | cr:3 | h:1 | crc:1 | de:1 |
+  uint64_t key = payloadSize;
+  key = (key << 16) | params.nPreamble;
+  key = (key << 20) | uint32_t (params.bandwidthHz);
+  key = (key << 4) | params.sf;
+  key = (key << 3) | params.codingRate;
+  key = (key << 1) | params.headerDisabled;
+  key = (key << 1) | params.crcEnabled;
+  key = (key << 1) | params.lowDataRateOptimizationEnabled;
+  return key;
+}
+
+Time
+LoraOnAirTimeCache::GetOnAirTime (uint32_t payloadSize,
+                                  const LoraTxParameters &params)
+{
+  std::unordered_map<uint64_t, Time> &table = GetTable ();
+  uint64_t key = GetKey (payloadSize, params);
+
+  std::unordered_map<uint64_t, Time>::const_iterator it = table.find (key);
+  if (it != table.end ())
+    {
+      m_nHits++;
+      return it->second;
+    }
+
+  NS_LOG_DEBUG ("Computing on-air time of a " << payloadSize << " bytes packet at SF" <<
+                unsigned (params.sf) << ", BW " << params.bandwidthHz);
+
+  m_nMisses++;
+  Time onAirTime = LoraPhy::GetOnAirTime (Create<Packet> (payloadSize), params);
+  table[key] = onAirTime;
+  return onAirTime;
+}
+
+void
+LoraOnAirTimeCache::Populate (const LoraRegionProfile &profile,
+                              uint32_t maxPayloadSize, uint32_t nPreamble,
+                              uint8_t codingRate, bool headerDisabled)
+{
+  NS_LOG_FUNCTION (profile.region << maxPayloadSize << nPreamble <<
+                   unsigned (codingRate) << headerDisabled);
+
+  LoraTxParameters params;
+  params.nPreamble = nPreamble;
+  params.codingRate = codingRate;
+  params.headerDisabled = headerDisabled;
+  params.crcEnabled = 1;
+  params.lowDataRateOptimizationEnabled = 0;
+
+  // The MAC may use any SF on the bandwidths of the region, so cover every
+  // combination instead of only the SF/bandwidth pairs of the data rates
+  for (uint8_t dataRate = 0; dataRate < LORA_MAX_DATA_RATES; dataRate++)
+    {
+      if (!profile.IsValidDataRate (dataRate))
+        {
+          continue;
+        }
+      params.bandwidthHz = profile.GetBandwidth (dataRate);
+      for (uint8_t sf = 7; sf <= 12; sf++)
+        {
+          params.sf = sf;
+          for (uint32_t size = 0; size <= maxPayloadSize; size++)
+            {
+              GetOnAirTime (size, params);
+            }
+        }
+    }
+
+  NS_LOG_INFO ("On-air time table holds " << GetN () << " entries");
+}
+
+std::size_t
+LoraOnAirTimeCache::GetN (void)
+{
+  return GetTable ().size ();
+}
+
+uint64_t
+LoraOnAirTimeCache::GetNHits (void)
+{
+  return m_nHits;
+}
+
+uint64_t
+LoraOnAirTimeCache::GetNMisses (void)
+{
+  return m_nMisses;
+}
+
+} // namespace lorawan
+} // namespace ns3
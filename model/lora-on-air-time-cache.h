@@ -0,0 +1,99 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_ON_AIR_TIME_CACHE_H
+#define LORA_ON_AIR_TIME_CACHE_H
+
+#include "ns3/lora-phy.h"
+#include "ns3/lora-region-parameters.h"
+#include "ns3/nstime.h"
+#include <unordered_map>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Process-wide table of packet on-air times.
+ *
+ * The on-air time of a LoRa packet only depends on the payload size and on
+ * the transmission parameters (SF, bandwidth, coding rate, header mode,
+ * preamble length, CRC and low data rate optimization), which take a few
+ * hundred distinct values across a fleet. Entries are computed once with
+ * LoraPhy::GetOnAirTime and then shared by the MAC, the duty cycle
+ * bookkeeping and any energy estimate that needs them.
+ *
+ * The simulator is single-threaded, so the table needs no locking. When
+ * the table is populated before worker processes are forked, all workers
+ * share its pages.
+ */
+class LoraOnAirTimeCache
+{
+public:
+  /**
+   * Get the on-air time of a packet.
+   *
+   * \param payloadSize The size of the PHY payload, in bytes.
+   * \param params The transmission parameters.
+   * \return The time the packet takes on air.
+   */
+  static Time GetOnAirTime (uint32_t payloadSize, const LoraTxParameters &params);
+
+  /**
+   * Fill the table for all the LoRa data rates of a region and all payload
+   * sizes up to a maximum, so that the simulation never has to compute an
+   * entry.
+   *
+   * \param profile The regional parameters.
+   * \param maxPayloadSize The largest PHY payload size, in bytes.
+   * \param nPreamble The number of preamble symbols.
+   * \param codingRate The coding rate, as in LoraTxParameters.
+   * \param headerDisabled Whether the header is disabled.
+   */
+  static void Populate (const LoraRegionProfile &profile,
+                        uint32_t maxPayloadSize, uint32_t nPreamble,
+                        uint8_t codingRate = 1, bool headerDisabled = false);
+
+  /**
+   * \return The number of entries in the table.
+   */
+  static std::size_t GetN (void);
+
+  /**
+   * \return The number of lookups that found their entry in the table.
+   */
+  static uint64_t GetNHits (void);
+
+  /**
+   * \return The number of lookups that had to compute their entry.
+   */
+  static uint64_t GetNMisses (void);
+
+private:
+  /**
+   * Pack the payload size and the transmission parameters in a single key.
+   */
+  static uint64_t GetKey (uint32_t payloadSize, const LoraTxParameters &params);
+
+  static std::unordered_map<uint64_t, Time> & GetTable (void);
+
+  static uint64_t m_nHits;
+  static uint64_t m_nMisses;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_ON_AIR_TIME_CACHE_H */
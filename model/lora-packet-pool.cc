@@ -0,0 +1,128 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-packet-pool.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraPacketPool");
+
+uint32_t LoraPacketPool::m_maxSize = 4096;
+uint64_t LoraPacketPool::m_nAcquired = 0;
+uint64_t LoraPacketPool::m_nAllocated = 0;
+
+std::deque<Ptr<Packet> > &
+LoraPacketPool::GetLent (void)
+{
+  static std::deque<Ptr<Packet> > lent;
+  return lent;
+}
+
+std::vector<Ptr<Packet> > &
+LoraPacketPool::GetFree (void)
+{
+  static std::vector<Ptr<Packet> > freePackets;
+  return freePackets;
+}
+
+Ptr<Packet>
+LoraPacketPool::GetPacket (void)
+{
+  std::deque<Ptr<Packet> > &lent = GetLent ();
+  std::vector<Ptr<Packet> > &freePackets = GetFree ();
+
+  // Packets are usually released in the order they were handed out, so
+  // only look at the oldest few. Those still in use go to the back.
+  for (int i = 0; i < 4 && !lent.empty (); i++)
+    {
+      Ptr<Packet> packet = lent.front ();
+      lent.pop_front ();
+      if (packet->GetReferenceCount () == 1)
+        {
+          // Nobody else references the packet anymore
+          freePackets.push_back (packet);
+        }
+      else
+        {
+          lent.push_back (packet);
+        }
+    }
+
+  Ptr<Packet> packet;
+  if (!freePackets.empty ())
+    {
+      packet = freePackets.back ();
+      freePackets.pop_back ();
+    }
+  else
+    {
+      packet = Create<Packet> ();
+      m_nAllocated++;
+    }
+
+  if (lent.size () < m_maxSize)
+    {
+      lent.push_back (packet);
+    }
+
+  m_nAcquired++;
+  return packet;
+}
+
+Ptr<Packet>
+LoraPacketPool::Acquire (uint32_t size)
+{
+  NS_LOG_FUNCTION (size);
+
+  Ptr<Packet> packet = GetPacket ();
+  *packet = Packet (size);
+  return packet;
+}
+
+Ptr<Packet>
+LoraPacketPool::AcquireCopy (Ptr<const Packet> original)
+{
+  NS_LOG_FUNCTION (original);
+
+  Ptr<Packet> packet = GetPacket ();
+  *packet = *original;
+  return packet;
+}
+
+void
+LoraPacketPool::SetMaxSize (uint32_t maxSize)
+{
+  NS_LOG_FUNCTION (maxSize);
+
+  m_maxSize = maxSize;
+}
+
+uint64_t
+LoraPacketPool::GetNAcquired (void)
+{
+  return m_nAcquired;
+}
+
+uint64_t
+LoraPacketPool::GetNAllocated (void)
+{
+  return m_nAllocated;
+}
+
+} // namespace lorawan
+} // namespace ns3
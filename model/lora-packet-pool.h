@@ -0,0 +1,94 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_PACKET_POOL_H
+#define LORA_PACKET_POOL_H
+
+#include "ns3/packet.h"
+#include <deque>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Process-wide pool of Packet objects for short-lived uplink and downlink
+ * packets.
+ *
+ * The pool keeps a reference to every packet it hands out. A packet is
+ * recycled once the pool holds the only reference left, i.e., once the
+ * MAC, the PHY, the channel and the packet tracker are all done with it.
+ * Recycled packets are reset to a fresh state, with a new UID, before
+ * being handed out again.
+ *
+ * The payload bytes are not pooled here: ns-3's Buffer already recycles
+ * its data through its own free list.
+ */
+class LoraPacketPool
+{
+public:
+  /**
+   * Get a packet with a zero-filled payload of the specified size, as
+   * Create<Packet> (size) would.
+   */
+  static Ptr<Packet> Acquire (uint32_t size);
+
+  /**
+   * Get a copy of a packet, as packet->Copy () would.
+   */
+  static Ptr<Packet> AcquireCopy (Ptr<const Packet> packet);
+
+  /**
+   * Set the maximum number of packets the pool keeps track of. Packets
+   * acquired beyond this number are not recycled.
+   */
+  static void SetMaxSize (uint32_t maxSize);
+
+  /**
+   * \return The number of packets handed out so far.
+   */
+  static uint64_t GetNAcquired (void);
+
+  /**
+   * \return The number of Packet objects actually allocated so far.
+   */
+  static uint64_t GetNAllocated (void);
+
+private:
+  /**
+   * Get a packet to reset, either a recycled one or a new one.
+   */
+  static Ptr<Packet> GetPacket (void);
+
+  /**
+   * Packets that were handed out, oldest first.
+   */
+  static std::deque<Ptr<Packet> > & GetLent (void);
+
+  /**
+   * Packets that nobody but the pool references anymore.
+   */
+  static std::vector<Ptr<Packet> > & GetFree (void);
+
+  static uint32_t m_maxSize;
+  static uint64_t m_nAcquired;
+  static uint64_t m_nAllocated;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_PACKET_POOL_H */
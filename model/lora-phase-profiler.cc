@@ -0,0 +1,159 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-phase-profiler.h"
+#include "ns3/simulator.h"
+#include "ns3/log.h"
+#include <algorithm>
+#include <fstream>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraPhaseProfiler");
+
+LoraPhaseProfiler::LoraPhaseProfiler ()
+  : m_current (-1),
+  m_startEvents (0)
+{
+}
+
+void
+LoraPhaseProfiler::Start (const std::string &phase)
+{
+  NS_LOG_FUNCTION (this << phase);
+
+  Stop ();
+
+  m_current = -1;
+  for (uint32_t i = 0; i < m_phases.size (); i++)
+    {
+      if (m_phases[i].name == phase)
+        {
+          m_current = i;
+        }
+    }
+  if (m_current < 0)
+    {
+      m_phases.push_back (Phase ());
+      m_phases.back ().name = phase;
+      m_current = m_phases.size () - 1;
+    }
+
+  ResetPeakRss ();
+  m_startEvents = Simulator::GetEventCount ();
+  m_start = std::chrono::steady_clock::now ();
+}
+
+void
+LoraPhaseProfiler::Stop (void)
+{
+  if (m_current < 0)
+    {
+      return;
+    }
+
+  Phase &phase = m_phases[m_current];
+  phase.seconds += std::chrono::duration<double>
+      (std::chrono::steady_clock::now () - m_start).count ();
+  // The count starts over if the simulator was destroyed during the phase
+  uint64_t nEvents = Simulator::GetEventCount ();
+  phase.nEvents += nEvents >= m_startEvents ? nEvents - m_startEvents : nEvents;
+  phase.peakRssBytes = std::max (phase.peakRssBytes, GetPeakRssBytes ());
+  NS_LOG_DEBUG (phase.name << ": " << phase.seconds << " s");
+  m_current = -1;
+}
+
+const LoraPhaseProfiler::Phase *
+LoraPhaseProfiler::Find (const std::string &name) const
+{
+  for (uint32_t i = 0; i < m_phases.size (); i++)
+    {
+      if (m_phases[i].name == name)
+        {
+          return &m_phases[i];
+        }
+    }
+  return 0;
+}
+
+double
+LoraPhaseProfiler::GetSeconds (const std::string &phase) const
+{
+  const Phase *found = Find (phase);
+  return found ? found->seconds : 0;
+}
+
+uint64_t
+LoraPhaseProfiler::GetNEvents (const std::string &phase) const
+{
+  const Phase *found = Find (phase);
+  return found ? found->nEvents : 0;
+}
+
+uint64_t
+LoraPhaseProfiler::GetPeakRssBytes (const std::string &phase) const
+{
+  const Phase *found = Find (phase);
+  return found ? found->peakRssBytes : 0;
+}
+
+void
+LoraPhaseProfiler::Print (std::ostream &os) const
+{
+  for (uint32_t i = 0; i < m_phases.size (); i++)
+    {
+      const Phase &phase = m_phases[i];
+      os << "Phase " << phase.name << ": " << phase.seconds << " s, " <<
+        phase.nEvents << " events";
+      if (phase.nEvents > 0 && phase.seconds > 0)
+        {
+          os << " (" << phase.nEvents / phase.seconds << " events/s)";
+        }
+      os << ", peak RSS " << phase.peakRssBytes / (1024 * 1024) << " MB" << std::endl;
+    }
+}
+
+uint64_t
+LoraPhaseProfiler::GetPeakRssBytes (void)
+{
+  std::ifstream status ("/proc/self/status");
+  std::string key;
+  while (status >> key)
+    {
+      if (key == "VmHWM:")
+        {
+          uint64_t kiloBytes = 0;
+          status >> kiloBytes;
+          return kiloBytes * 1024;
+        }
+      status.ignore (256, '\n');
+    }
+  return 0;
+}
+
+bool
+LoraPhaseProfiler::ResetPeakRss (void)
+{
+  // Writing 5 resets the high water mark of the RSS (Linux 4.0 and later)
+  std::ofstream clearRefs ("/proc/self/clear_refs");
+  clearRefs << "5";
+  clearRefs.flush ();
+  return bool (clearRefs);
+}
+
+} // namespace lorawan
+} // namespace ns3
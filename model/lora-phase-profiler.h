@@ -0,0 +1,117 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_PHASE_PROFILER_H
+#define LORA_PHASE_PROFILER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Measures the phases of a simulation script: wall-clock time (monotonic
+ * clock), simulator events executed, and peak resident set size.
+ *
+ * Phases run one after the other: starting a phase stops the current one.
+ * A phase started again accumulates its time and events.
+ *
+ * The peak RSS of a phase is VmHWM from /proc/self/status when it stops.
+ * When the phase starts, the high water mark is reset to the current RSS
+ * through /proc/self/clear_refs, so the value is the peak of that phase
+ * alone; on systems where the reset is not allowed, it is the peak of the
+ * process so far.
+ */
+class LoraPhaseProfiler
+{
+public:
+  LoraPhaseProfiler ();
+
+  /**
+   * Stop the current phase, if any, and start another.
+   */
+  void Start (const std::string &phase);
+
+  /**
+   * Stop the current phase.
+   */
+  void Stop (void);
+
+  /**
+   * \return The wall-clock time spent in a phase, in seconds, or 0 if it
+   * never ran.
+   */
+  double GetSeconds (const std::string &phase) const;
+
+  /**
+   * \return The number of simulator events executed during a phase.
+   */
+  uint64_t GetNEvents (const std::string &phase) const;
+
+  /**
+   * \return The peak resident set size during a phase, in bytes.
+   */
+  uint64_t GetPeakRssBytes (const std::string &phase) const;
+
+  /**
+   * Print one line per phase.
+   */
+  void Print (std::ostream &os) const;
+
+  /**
+   * \return The peak resident set size of the process (VmHWM), in bytes,
+   * or 0 if it is not available.
+   */
+  static uint64_t GetPeakRssBytes (void);
+
+  /**
+   * Reset the peak resident set size of the process to its current RSS.
+   *
+   * \return Whether the reset is supported.
+   */
+  static bool ResetPeakRss (void);
+
+private:
+  /**
+   * A phase and what it cost so far.
+   */
+  struct Phase
+  {
+    std::string name;
+    double seconds = 0;
+    uint64_t nEvents = 0;
+    uint64_t peakRssBytes = 0;
+  };
+
+  /**
+   * \return The phase with that name, or 0.
+   */
+  const Phase *Find (const std::string &name) const;
+
+  std::vector<Phase> m_phases;
+  int m_current;                 //!< Index of the running phase, or -1
+  std::chrono::steady_clock::time_point m_start;
+  uint64_t m_startEvents;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_PHASE_PROFILER_H */
@@ -0,0 +1,218 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-progress-monitor.h"
+#include "ns3/lora-radio-energy-model.h"
+#include "ns3/simulator.h"
+#include "ns3/log.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraProgressMonitor");
+
+LoraProgressMonitor::LoraProgressMonitor (double interval)
+  : m_interval (interval),
+  m_stopTime (Seconds (0)),
+  m_step (Seconds (1)),
+  m_lastReportTime (Seconds (0)),
+  m_lastReportEvents (0),
+  m_nReports (0)
+{
+}
+
+LoraProgressMonitor::~LoraProgressMonitor ()
+{
+  m_probe.Cancel ();
+}
+
+void
+LoraProgressMonitor::SetStatusFile (const std::string &fileName)
+{
+  m_statusFile = fileName;
+}
+
+void
+LoraProgressMonitor::SetEnergy (EnergySourceContainer sources,
+                                DeviceEnergyModelContainer models)
+{
+  m_sources = sources;
+  m_models = models;
+}
+
+void
+LoraProgressMonitor::Start (Time stopTime)
+{
+  NS_LOG_FUNCTION (this << stopTime);
+
+  m_stopTime = stopTime;
+  m_startWall = std::chrono::steady_clock::now ();
+  m_lastProbeWall = m_startWall;
+  m_lastReportWall = m_startWall;
+  m_lastReportTime = Simulator::Now ();
+  m_lastReportEvents = Simulator::GetEventCount ();
+  m_startConsumption.resize (m_models.GetN ());
+  for (uint32_t i = 0; i < m_models.GetN (); i++)
+    {
+      m_startConsumption[i] = m_models.Get (i)->GetTotalEnergyConsumption ();
+    }
+  m_probe = Simulator::Schedule (m_step, &LoraProgressMonitor::Probe, this);
+}
+
+void
+LoraProgressMonitor::Stop (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  m_probe.Cancel ();
+  Report (true);
+}
+
+uint32_t
+LoraProgressMonitor::GetNReports (void) const
+{
+  return m_nReports;
+}
+
+void
+LoraProgressMonitor::Probe (void)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+  double sinceProbe = std::chrono::duration<double> (now - m_lastProbeWall).count ();
+  m_lastProbeWall = now;
+
+  // Aim at ten probes per report, changing the step by at most a factor of
+  // two at a time so that a single slow event does not throw it off
+  double factor = m_interval / 10 / std::max (sinceProbe, 1e-6);
+  factor = std::min (std::max (factor, 0.5), 2.0);
+  m_step = std::max (Seconds (m_step.GetSeconds () * factor), MilliSeconds (1));
+
+  if (std::chrono::duration<double> (now - m_lastReportWall).count () >= m_interval)
+    {
+      Report (false);
+    }
+
+  if (Simulator::Now () + m_step < m_stopTime)
+    {
+      m_probe = Simulator::Schedule (m_step, &LoraProgressMonitor::Probe, this);
+    }
+}
+
+void
+LoraProgressMonitor::Report (bool done)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+  double wallSeconds = std::chrono::duration<double> (now - m_startWall).count ();
+  double sinceReport = std::chrono::duration<double> (now - m_lastReportWall).count ();
+  double simSeconds = Simulator::Now ().GetSeconds ();
+  uint64_t nEvents = Simulator::GetEventCount ();
+
+  // Rates over the last interval, which follow the run as it speeds up
+  // (devices running out of battery) or slows down
+  double eventsPerSecond = 0;
+  double speed = 0;
+  if (sinceReport > 0)
+    {
+      eventsPerSecond = (nEvents - m_lastReportEvents) / sinceReport;
+      speed = (Simulator::Now () - m_lastReportTime).GetSeconds () / sinceReport;
+    }
+  double remaining = std::max ((m_stopTime - Simulator::Now ()).GetSeconds (), 0.0);
+  double eta = done ? 0 : speed > 0 ? remaining / speed : -1;
+
+  // Energy consumed as of the last state change of each radio, since the
+  // start (a resumed run starts with the energy that was left)
+  double energySum = 0;
+  double energyMin = 0;
+  uint32_t nDepleted = 0;
+  uint32_t nDevices = std::min (m_sources.GetN (), m_models.GetN ());
+  for (uint32_t i = 0; i < nDevices; i++)
+    {
+      double energy = m_sources.Get (i)->GetInitialEnergy () -
+        (m_models.Get (i)->GetTotalEnergyConsumption () - m_startConsumption[i]);
+      energy = std::max (energy, 0.0);
+      energySum += energy;
+      energyMin = i == 0 ? energy : std::min (energyMin, energy);
+      Ptr<LoraRadioEnergyModel> model = DynamicCast<LoraRadioEnergyModel> (m_models.Get (i));
+      if (model && model->IsDepleted ())
+        {
+          nDepleted++;
+        }
+    }
+
+  std::ostringstream status;
+  if (m_statusFile.empty ())
+    {
+      status << "Progress: " << simSeconds << " of " << m_stopTime.GetSeconds () <<
+        " s simulated (" << (m_stopTime.IsStrictlyPositive () ?
+                             100 * simSeconds / m_stopTime.GetSeconds () : 100) <<
+        "%), " << eventsPerSecond << " events/s, " << speed << "x real time, ETA ";
+      if (eta < 0)
+        {
+          status << "unknown";
+        }
+      else
+        {
+          status << eta << " s";
+        }
+      if (nDevices > 0)
+        {
+          status << ", energy mean " << energySum / nDevices << " J, min " <<
+            energyMin << " J, " << nDepleted << " of " << nDevices << " depleted";
+        }
+      std::cerr << status.str () << std::endl;
+    }
+  else
+    {
+      status << "pid=" << getpid () << "\n" <<
+        "done=" << done << "\n" <<
+        "simSeconds=" << simSeconds << "\n" <<
+        "stopSeconds=" << m_stopTime.GetSeconds () << "\n" <<
+        "wallSeconds=" << wallSeconds << "\n" <<
+        "events=" << nEvents << "\n" <<
+        "eventsPerSecond=" << eventsPerSecond << "\n" <<
+        "speed=" << speed << "\n" <<
+        "etaSeconds=" << eta << "\n" <<
+        "devices=" << nDevices << "\n" <<
+        "energyMean=" << (nDevices ? energySum / nDevices : 0) << "\n" <<
+        "energyMin=" << energyMin << "\n" <<
+        "depleted=" << nDepleted << "\n";
+
+      // Readers see either the previous report or this one, never half
+      std::string temporary = m_statusFile + ".tmp";
+      std::ofstream file (temporary.c_str ());
+      file << status.str ();
+      file.close ();
+      if (!file || std::rename (temporary.c_str (), m_statusFile.c_str ()) != 0)
+        {
+          NS_LOG_WARN ("Cannot write the status file " << m_statusFile);
+          std::remove (temporary.c_str ());
+        }
+    }
+
+  m_lastReportWall = now;
+  m_lastReportTime = Simulator::Now ();
+  m_lastReportEvents = nEvents;
+  m_nReports++;
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,124 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_PROGRESS_MONITOR_H
+#define LORA_PROGRESS_MONITOR_H
+
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+#include "ns3/energy-source-container.h"
+#include "ns3/device-energy-model-container.h"
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Reports the progress of a running simulation every few seconds of wall
+ * time: simulated time, events per second, simulated-to-real time ratio,
+ * estimated time to the end, and the state of the batteries of the fleet.
+ *
+ * The monitor owns a single simulator event, the probe, which reads the
+ * wall clock and reschedules itself. The simulated time between probes
+ * adapts so that there are about ten probes per report interval whatever
+ * the speed of the simulation, which keeps their cost negligible.
+ *
+ * Each report is a line on stderr, or, with a status file, a set of
+ * "name=value" lines that replace the file atomically (write and rename),
+ * so that another process, such as a sweep runner, can poll it at any
+ * time.
+ *
+ * Reading the batteries must not change the run: the monitor only reads
+ * the energy consumed as of the last state change of each radio, and never
+ * updates the energy sources.
+ */
+class LoraProgressMonitor
+{
+public:
+  /**
+   * \param interval The wall-clock time between reports, in seconds.
+   */
+  LoraProgressMonitor (double interval);
+  ~LoraProgressMonitor ();
+
+  /**
+   * Write the reports to a status file instead of stderr.
+   */
+  void SetStatusFile (const std::string &fileName);
+
+  /**
+   * Report the remaining energy of the fleet.
+   *
+   * \param sources The energy sources of the devices.
+   * \param models The radio energy models, one per source, in the same
+   * order.
+   */
+  void SetEnergy (EnergySourceContainer sources, DeviceEnergyModelContainer models);
+
+  /**
+   * Start monitoring, before Simulator::Run.
+   *
+   * \param stopTime The simulated time at which the run stops.
+   */
+  void Start (Time stopTime);
+
+  /**
+   * Stop monitoring, after Simulator::Run, and write a final report.
+   */
+  void Stop (void);
+
+  /**
+   * \return The number of reports written.
+   */
+  uint32_t GetNReports (void) const;
+
+private:
+  /**
+   * Check the wall clock, report if it is time, and schedule the next
+   * probe.
+   */
+  void Probe (void);
+
+  /**
+   * Write a report.
+   *
+   * \param done Whether the run is over.
+   */
+  void Report (bool done);
+
+  double m_interval;               //!< Seconds of wall time between reports
+  std::string m_statusFile;
+  EnergySourceContainer m_sources;
+  DeviceEnergyModelContainer m_models;
+  std::vector<double> m_startConsumption;   //!< Energy consumed at the start
+  Time m_stopTime;
+  Time m_step;                     //!< Simulated time between probes
+  EventId m_probe;
+  std::chrono::steady_clock::time_point m_startWall;
+  std::chrono::steady_clock::time_point m_lastProbeWall;
+  std::chrono::steady_clock::time_point m_lastReportWall;
+  Time m_lastReportTime;
+  uint64_t m_lastReportEvents;
+  uint32_t m_nReports;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_PROGRESS_MONITOR_H */
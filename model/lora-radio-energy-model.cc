@@ -18,7 +18,13 @@
 #include "ns3/simulator.h"
 #include "ns3/pointer.h"
 #include "ns3/energy-source.h"
+#include "ns3/boolean.h"
+#include "ns3/node.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/lora-channel.h"
+#include "ns3/periodic-sender.h"
 #include "lora-radio-energy-model.h"
+#include "end-device-lora-mac.h"
 
 
 namespace ns3 {
@@ -63,6 +69,19 @@ LoraRadioEnergyModel::GetTypeId (void)
                    PointerValue (),
                    MakePointerAccessor (&LoraRadioEnergyModel::m_txCurrentModel),
                    MakePointerChecker<LoraTxCurrentModel> ())
+    .AddAttribute ("QuiesceOnDepletion",
+                   "Whether to stop all the activity of the end device MACs "
+                   "of the node when the energy source is depleted.",
+                   BooleanValue (true),
+                   MakeBooleanAccessor (&LoraRadioEnergyModel::m_quiesceOnDepletion),
+                   MakeBooleanChecker ())
+    .AddAttribute ("DetachOnDepletion",
+                   "Whether to also remove the PHYs of the quiesced devices "
+                   "from their channel, so that they are not delivered "
+                   "transmissions anymore.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&LoraRadioEnergyModel::m_detachOnDepletion),
+                   MakeBooleanChecker ())
     .AddTraceSource ("TotalEnergyConsumption",
                      "Total energy consumption of the radio device.",
                      MakeTraceSourceAccessor (&LoraRadioEnergyModel::m_totalEnergyConsumption),
@@ -78,6 +97,9 @@ LoraRadioEnergyModel::LoraRadioEnergyModel ()
   m_lastUpdateTime = Seconds (0.0);
   m_nPendingChangeState = 0;
   m_isSupersededChangeState = false;
+  m_quiesceOnDepletion = true;
+  m_detachOnDepletion = false;
+  m_depletionTime = Time::Max ();
   m_energyDepletionCallback.Nullify ();
   m_source = NULL;
   // set callback for EndDeviceLoraPhy listener
@@ -277,6 +299,14 @@ LoraRadioEnergyModel::HandleEnergyDepletion (void)
 {
   NS_LOG_FUNCTION (this);
   NS_LOG_DEBUG ("LoraRadioEnergyModel:Energy is depleted!");
+
+  if (IsDepleted ())
+    {
+      return;
+    }
+  m_depletionTime = Simulator::Now ();
+  QuiesceNode (false);
+
   // invoke energy depletion callback, if set.
   if (!m_energyDepletionCallback.IsNull ())
     {
@@ -284,6 +314,96 @@ LoraRadioEnergyModel::HandleEnergyDepletion (void)
     }
 }
 
+void
+LoraRadioEnergyModel::QuiesceNode (bool restored)
+{
+  NS_LOG_FUNCTION (this << restored);
+
+  Ptr<Node> node = m_source->GetNode ();
+  if (m_quiesceOnDepletion && node)
+    {
+      for (uint32_t i = 0; i < node->GetNDevices (); i++)
+        {
+          Ptr<LoraNetDevice> device = DynamicCast<LoraNetDevice> (node->GetDevice (i));
+          if (!device)
+            {
+              continue;
+            }
+          Ptr<EndDeviceLoraMac> mac = DynamicCast<EndDeviceLoraMac> (device->GetMac ());
+          if (!mac)
+            {
+              continue;
+            }
+          NS_LOG_INFO ("Quiescing the end device of node " << node->GetId () <<
+                       " at time = " << m_depletionTime.GetSeconds () << " s");
+          if (restored)
+            {
+              mac->MarkQuiesced ();
+            }
+          else
+            {
+              mac->Quiesce ();
+            }
+
+          Ptr<LoraPhy> phy = device->GetPhy ();
+          if (m_detachOnDepletion && phy->GetChannel ())
+            {
+              phy->GetChannel ()->Remove (phy);
+            }
+        }
+
+      // Cancel the next send of the traffic generators, which would
+      // otherwise wake up once per period until the end of the run
+      for (uint32_t i = 0; i < node->GetNApplications (); i++)
+        {
+          Ptr<PeriodicSender> sender = DynamicCast<PeriodicSender> (node->GetApplication (i));
+          if (sender)
+            {
+              sender->StopApplication ();
+            }
+        }
+    }
+}
+
+bool
+LoraRadioEnergyModel::IsDepleted (void) const
+{
+  return m_depletionTime != Time::Max ();
+}
+
+Time
+LoraRadioEnergyModel::GetDepletionTime (void) const
+{
+  return m_depletionTime;
+}
+
+double
+LoraRadioEnergyModel::GetEnergyConsumptionToDate (void) const
+{
+  Time duration = Simulator::Now () - m_lastUpdateTime;
+  return m_totalEnergyConsumption +
+         duration.GetSeconds () * DoGetCurrentA () * m_source->GetSupplyVoltage ();
+}
+
+void
+LoraRadioEnergyModel::RestoreEnergyConsumption (double totalEnergyConsumption,
+                                                Time depletionTime)
+{
+  NS_LOG_FUNCTION (this << totalEnergyConsumption << depletionTime);
+
+  m_totalEnergyConsumption = totalEnergyConsumption;
+  m_lastUpdateTime = Simulator::Now ();
+  if (depletionTime != Time::Max () && !IsDepleted ())
+    {
+      m_depletionTime = depletionTime;
+      QuiesceNode (true);
+      if (!m_energyDepletionCallback.IsNull ())
+        {
+          m_energyDepletionCallback ();
+        }
+    }
+}
+
 void
 LoraRadioEnergyModel::HandleEnergyChanged (void)
 {
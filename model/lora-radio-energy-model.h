@@ -257,10 +257,45 @@ public:
   /**
    * \brief Handles energy depletion.
    *
+   * Unless the QuiesceOnDepletion attribute is false, the end device MACs of
+   * the node are quiesced (see EndDeviceLoraMac::Quiesce) and its
+   * PeriodicSender applications are stopped before the depletion callback
+   * is invoked.
+   *
    * Implements DeviceEnergyModel::HandleEnergyDepletion
    */
   void HandleEnergyDepletion (void);
 
+  /**
+   * \returns Whether the energy source was found depleted.
+   */
+  bool IsDepleted (void) const;
+
+  /**
+   * \returns The time at which the energy source was found depleted, or
+   * Time::Max () if it never was.
+   */
+  Time GetDepletionTime (void) const;
+
+  /**
+   * \returns The total energy consumption up to now, including the time
+   * spent in the current state since the last state change.
+   */
+  double GetEnergyConsumptionToDate (void) const;
+
+  /**
+   * \brief Restores the energy consumption of a checkpoint, e.g., to resume
+   * a run.
+   *
+   * The consumption is accounted up to now. If a depletion time is given,
+   * the energy is handled as depleted at that time, as in
+   * HandleEnergyDepletion, except that the PHYs are not touched.
+   *
+   * \param totalEnergyConsumption The total energy consumption, in J.
+   * \param depletionTime The time of the depletion, or Time::Max ().
+   */
+  void RestoreEnergyConsumption (double totalEnergyConsumption, Time depletionTime);
+
   /**
    * \brief Handles energy recharged.
    *
@@ -284,6 +319,16 @@ public:
 private:
   void DoDispose (void);
 
+  /**
+   * Quiesce the end device MACs of the node and stop its PeriodicSender
+   * applications, unless QuiesceOnDepletion is false.
+   *
+   * \param restored Whether the depletion is restored from a checkpoint,
+   * before the simulation starts: the PHYs are then left in their initial
+   * state (see EndDeviceLoraMac::MarkQuiesced).
+   */
+  void QuiesceNode (bool restored);
+
   /**
    * \returns Current draw of device, at current state.
    *
@@ -325,6 +370,10 @@ private:
   /// Energy recharged callback
   LoraRadioEnergyRechargedCallback m_energyRechargedCallback;
 
+  bool m_quiesceOnDepletion; ///< quiesce the end device MACs on depletion
+  bool m_detachOnDepletion; ///< remove the PHYs from their channel on depletion
+  Time m_depletionTime; ///< time of the energy depletion
+
   /// EndDeviceLoraPhy listener
   LoraRadioEnergyModelPhyListener *m_listener;
 };
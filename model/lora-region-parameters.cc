@@ -0,0 +1,166 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-region-parameters.h"
+#include "ns3/fatal-error.h"
+
+namespace ns3 {
+namespace lorawan {
+
+namespace {
+
+// EU863-870. Payload sizes are the ones LoraMacHelper::ConfigureForEuRegion
+// sets, so that EU devices behave as with the per-device vectors.
+constexpr LoraRegionProfile EU868_PROFILE = {
+  EU868,
+  8,
+  5,
+  {12, 11, 10, 9, 8, 7, 7, 0},
+  {125000, 125000, 125000, 125000, 125000, 125000, 250000, 0},
+  {59, 59, 59, 123, 230, 230, 230, 230},
+  {{0, 0, 0, 0, 0, 0},
+   {1, 0, 0, 0, 0, 0},
+   {2, 1, 0, 0, 0, 0},
+   {3, 2, 1, 0, 0, 0},
+   {4, 3, 2, 1, 0, 0},
+   {5, 4, 3, 2, 1, 0},
+   {6, 5, 4, 3, 2, 1},
+   {7, 6, 5, 4, 3, 2}},
+  8,
+  {16, 14, 12, 10, 8, 6, 4, 2}
+};
+
+// US902-928. DR5-DR7 are reserved, DR8-DR13 are downlink only.
+constexpr LoraRegionProfile US915_PROFILE = {
+  US915,
+  5,
+  3,
+  {10, 9, 8, 7, 8, 0, 0, 0, 12, 11, 10, 9, 8, 7},
+  {125000, 125000, 125000, 125000, 500000, 0, 0, 0,
+   500000, 500000, 500000, 500000, 500000, 500000},
+  {19, 61, 133, 250, 250, 0, 0, 0, 41, 117, 230, 230, 230, 230},
+  {{10, 9, 8, 8},
+   {11, 10, 9, 8},
+   {12, 11, 10, 9},
+   {13, 12, 11, 10},
+   {13, 13, 12, 11}},
+  11,
+  {30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10}
+};
+
+// AU915-928. DR7 is reserved, DR8-DR13 are downlink only.
+constexpr LoraRegionProfile AU915_PROFILE = {
+  AU915,
+  7,
+  5,
+  {12, 11, 10, 9, 8, 7, 8, 0, 12, 11, 10, 9, 8, 7},
+  {125000, 125000, 125000, 125000, 125000, 125000, 500000, 0,
+   500000, 500000, 500000, 500000, 500000, 500000},
+  {59, 59, 59, 123, 230, 230, 230, 0, 41, 117, 230, 230, 230, 230},
+  {{8, 8, 8, 8, 8, 8},
+   {9, 8, 8, 8, 8, 8},
+   {10, 9, 8, 8, 8, 8},
+   {11, 10, 9, 8, 8, 8},
+   {12, 11, 10, 9, 8, 8},
+   {13, 12, 11, 10, 9, 8},
+   {13, 13, 12, 11, 10, 9}},
+  11,
+  {30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10}
+};
+
+// AS923, with DownlinkDwellTime = 0. RX1DROffset values 6 and 7 stand for
+// the effective offsets -1 and -2.
+constexpr LoraRegionProfile AS923_PROFILE = {
+  AS923,
+  8,
+  7,
+  {12, 11, 10, 9, 8, 7, 7, 0},
+  {125000, 125000, 125000, 125000, 125000, 125000, 250000, 0},
+  {59, 59, 59, 123, 230, 230, 230, 230},
+  {{0, 0, 0, 0, 0, 0, 1, 2},
+   {1, 0, 0, 0, 0, 0, 2, 3},
+   {2, 1, 0, 0, 0, 0, 3, 4},
+   {3, 2, 1, 0, 0, 0, 4, 5},
+   {4, 3, 2, 1, 0, 0, 5, 5},
+   {5, 4, 3, 2, 1, 0, 5, 5},
+   {5, 5, 4, 3, 2, 1, 5, 5},
+   {5, 5, 5, 4, 3, 2, 5, 5}},
+  8,
+  {16, 14, 12, 10, 8, 6, 4, 2}
+};
+
+// Check, for every uplink LoRa data rate and allowed offset, that the first
+// receive window uses a valid LoRa data rate. Written as recursions to stay
+// within C++11 constexpr rules.
+constexpr bool
+CheckReplyDataRates (const LoraRegionProfile &profile, unsigned dataRate,
+                     unsigned offset)
+{
+  return dataRate >= profile.nUplinkDataRates
+         ? true
+         : offset > profile.maxRx1DrOffset
+         ? CheckReplyDataRates (profile, dataRate + 1, 0)
+         : (!profile.IsValidDataRate (dataRate)
+            || profile.IsValidDataRate (profile.replyDataRate[dataRate][offset]))
+         && CheckReplyDataRates (profile, dataRate, offset + 1);
+}
+
+// Check that every LoRa data rate has room for a payload
+constexpr bool
+CheckPayloadSizes (const LoraRegionProfile &profile, unsigned dataRate)
+{
+  return dataRate >= LORA_MAX_DATA_RATES
+         ? true
+         : (!profile.IsValidDataRate (dataRate)
+            || profile.maxAppPayloadForDataRate[dataRate] > 0)
+         && CheckPayloadSizes (profile, dataRate + 1);
+}
+
+static_assert (CheckReplyDataRates (EU868_PROFILE, 0, 0), "EU868 reply data rates");
+static_assert (CheckReplyDataRates (US915_PROFILE, 0, 0), "US915 reply data rates");
+static_assert (CheckReplyDataRates (AU915_PROFILE, 0, 0), "AU915 reply data rates");
+static_assert (CheckReplyDataRates (AS923_PROFILE, 0, 0), "AS923 reply data rates");
+static_assert (CheckPayloadSizes (EU868_PROFILE, 0), "EU868 payload sizes");
+static_assert (CheckPayloadSizes (US915_PROFILE, 0), "US915 payload sizes");
+static_assert (CheckPayloadSizes (AU915_PROFILE, 0), "AU915 payload sizes");
+static_assert (CheckPayloadSizes (AS923_PROFILE, 0), "AS923 payload sizes");
+static_assert (EU868_PROFILE.maxRx1DrOffset < LORA_MAX_RX1_DR_OFFSETS
+               && US915_PROFILE.maxRx1DrOffset < LORA_MAX_RX1_DR_OFFSETS
+               && AU915_PROFILE.maxRx1DrOffset < LORA_MAX_RX1_DR_OFFSETS
+               && AS923_PROFILE.maxRx1DrOffset < LORA_MAX_RX1_DR_OFFSETS,
+               "RX1DROffset out of table bounds");
+
+} // anonymous namespace
+
+const LoraRegionProfile &
+GetLoraRegionProfile (LoraRegion region)
+{
+  switch (region)
+    {
+    case EU868:
+      return EU868_PROFILE;
+    case US915:
+      return US915_PROFILE;
+    case AU915:
+      return AU915_PROFILE;
+    case AS923:
+      return AS923_PROFILE;
+    }
+  NS_FATAL_ERROR ("Unknown LoRaWAN region " << region);
+}
+
+} // namespace lorawan
+} // namespace ns3
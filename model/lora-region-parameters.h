@@ -0,0 +1,138 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_REGION_PARAMETERS_H
+#define LORA_REGION_PARAMETERS_H
+
+#include <stdint.h>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Maximum number of data rates a region can define (DR0 to DR15).
+ */
+static const uint8_t LORA_MAX_DATA_RATES = 16;
+
+/**
+ * Maximum number of RX1DROffset values a region can define.
+ */
+static const uint8_t LORA_MAX_RX1_DR_OFFSETS = 8;
+
+/**
+ * Maximum number of TXPower indexes a region can define (the 4-bit field
+ * of LinkAdrReq).
+ */
+static const uint8_t LORA_MAX_TX_POWERS = 16;
+
+/**
+ * The regional band plans for which a parameter table is available.
+ */
+enum LoraRegion
+{
+  EU868,
+  US915,
+  AU915,
+  AS923
+};
+
+/**
+ * Per-region constants of the LoRaWAN Regional Parameters specification
+ * (v1.0.2rB) that the end device MAC looks up on every transmission.
+ *
+ * Tables are shared by all devices of a region: a device only stores a
+ * pointer to its profile. Data rates that are not defined, or that are not
+ * LoRa data rates (e.g., FSK), have a spreading factor and bandwidth of 0.
+ */
+struct LoraRegionProfile
+{
+  LoraRegion region;
+
+  /**
+   * Number of data rates, starting from DR0, that devices can use in uplink.
+   */
+  uint8_t nUplinkDataRates;
+
+  /**
+   * Highest RX1DROffset value allowed in the region.
+   */
+  uint8_t maxRx1DrOffset;
+
+  uint8_t sfForDataRate[LORA_MAX_DATA_RATES];
+  uint32_t bandwidthForDataRate[LORA_MAX_DATA_RATES];   //!< In Hz
+
+  /**
+   * Maximum MAC payload, in bytes, as configured by the LoraMacHelper.
+   */
+  uint16_t maxAppPayloadForDataRate[LORA_MAX_DATA_RATES];
+
+  /**
+   * Data rate of the first receive window, indexed by uplink data rate and
+   * RX1DROffset.
+   */
+  uint8_t replyDataRate[LORA_MAX_DATA_RATES][LORA_MAX_RX1_DR_OFFSETS];
+
+  /**
+   * Number of TXPower indexes, starting from 0, defined in the region.
+   */
+  uint8_t nTxPowers;
+
+  /**
+   * Transmission power, in dBm, for each TXPower index of LinkAdrReq: the
+   * maximum EIRP of the region, then steps of 2 dB.
+   */
+  double txPowerDbm[LORA_MAX_TX_POWERS];
+
+  constexpr uint8_t
+  GetSf (uint8_t dataRate) const
+  {
+    return dataRate < LORA_MAX_DATA_RATES ? sfForDataRate[dataRate] : 0;
+  }
+
+  constexpr double
+  GetBandwidth (uint8_t dataRate) const
+  {
+    return dataRate < LORA_MAX_DATA_RATES ? bandwidthForDataRate[dataRate] : 0;
+  }
+
+  /**
+   * \return The power of a TXPower index, or 0 if the index is not defined.
+   */
+  constexpr double
+  GetTxPowerDbm (uint8_t txPower) const
+  {
+    return txPower < nTxPowers ? txPowerDbm[txPower] : 0;
+  }
+
+  /**
+   * Check whether a data rate can be used for LoRa transmissions.
+   */
+  constexpr bool
+  IsValidDataRate (uint8_t dataRate) const
+  {
+    return GetSf (dataRate) != 0 && GetBandwidth (dataRate) != 0;
+  }
+};
+
+/**
+ * Get the parameter table of a region.
+ */
+const LoraRegionProfile & GetLoraRegionProfile (LoraRegion region);
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_REGION_PARAMETERS_H */
@@ -0,0 +1,338 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-replication-runner.h"
+#include "ns3/log.h"
+#include "ns3/fatal-error.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraReplicationRunner");
+
+namespace {
+
+// Quantile of the standard normal distribution (Acklam's approximation,
+// relative error below 1.2e-9)
+double
+GetNormalQuantile (double p)
+{
+  static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                              -2.759285104469687e+02, 1.383577518672690e+02,
+                              -3.066479806614716e+01, 2.506628277459239e+00};
+  static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                              -1.556989798598866e+02, 6.680131188771972e+01,
+                              -1.328068155288572e+01};
+  static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                              -2.400758277161838e+00, -2.549732539343734e+00,
+                              4.374664141464968e+00, 2.938163982698783e+00};
+  static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01,
+                              2.445134137142996e+00, 3.754408661907416e+00};
+
+  if (p < 0.02425)
+    {
+      double q = std::sqrt (-2 * std::log (p));
+      return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+             ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+  if (p > 1 - 0.02425)
+    {
+      return -GetNormalQuantile (1 - p);
+    }
+  double q = p - 0.5;
+  double r = q * q;
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+         (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+} // namespace
+
+LoraReplicationRunner::LoraReplicationRunner (uint32_t nWorkers, uint32_t nMetrics)
+  : m_nWorkers (nWorkers),
+  m_nMetrics (nMetrics),
+  m_relativeHalfWidth (0.01),
+  m_confidence (0.95),
+  m_minRuns (5),
+  m_maxRuns (30),
+  m_firstRun (1),
+  m_nFailed (0),
+  m_reportFd (-1)
+{
+  if (m_nWorkers == 0)
+    {
+      long nProcessors = sysconf (_SC_NPROCESSORS_ONLN);
+      m_nWorkers = nProcessors > 0 ? nProcessors : 1;
+    }
+}
+
+void
+LoraReplicationRunner::SetTarget (double relativeHalfWidth, double confidence)
+{
+  m_relativeHalfWidth = relativeHalfWidth;
+  m_confidence = confidence;
+}
+
+void
+LoraReplicationRunner::SetRuns (uint32_t minRuns, uint32_t maxRuns, uint32_t firstRun)
+{
+  m_minRuns = std::max<uint32_t> (minRuns, 2);
+  m_maxRuns = std::max (maxRuns, m_minRuns);
+  m_firstRun = firstRun;
+}
+
+double
+LoraReplicationRunner::GetStudentQuantile (double p, uint32_t dof)
+{
+  double z = GetNormalQuantile (p);
+  double z2 = z * z;
+  double v = dof;
+  return z + z * (z2 + 1) / (4 * v)
+         + z * ((5 * z2 + 16) * z2 + 3) / (96 * v * v)
+         + z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * v * v * v);
+}
+
+double
+LoraReplicationRunner::GetMean (uint32_t configuration, uint32_t metric) const
+{
+  return m_configurations[configuration].metrics[metric].mean;
+}
+
+double
+LoraReplicationRunner::GetHalfWidth (uint32_t configuration, uint32_t metric) const
+{
+  const Statistics &statistics = m_configurations[configuration].metrics[metric];
+  if (statistics.n < 2)
+    {
+      return std::numeric_limits<double>::infinity ();
+    }
+  double variance = statistics.m2 / (statistics.n - 1);
+  return GetStudentQuantile (0.5 + m_confidence / 2, statistics.n - 1) *
+         std::sqrt (variance / statistics.n);
+}
+
+double
+LoraReplicationRunner::GetDistanceToTarget (uint32_t configuration) const
+{
+  double distance = 0;
+  for (uint32_t metric = 0; metric < m_nMetrics; metric++)
+    {
+      double mean = std::fabs (GetMean (configuration, metric));
+      double target = m_relativeHalfWidth * (mean > 0 ? mean : 1);
+      distance = std::max (distance, GetHalfWidth (configuration, metric) / target);
+    }
+  return distance;
+}
+
+bool
+LoraReplicationRunner::IsConverged (uint32_t configuration) const
+{
+  return m_configurations[configuration].nRuns >= m_minRuns
+         && GetDistanceToTarget (configuration) <= 1;
+}
+
+uint32_t
+LoraReplicationRunner::GetNRuns (uint32_t configuration) const
+{
+  return m_configurations[configuration].nRuns;
+}
+
+uint32_t
+LoraReplicationRunner::GetNFailed (void) const
+{
+  return m_nFailed;
+}
+
+int
+LoraReplicationRunner::PickNext (const std::vector<LoraSweepRunner::Job> &configurations) const
+{
+  int best = -1;
+  double bestScore = 0;
+  for (uint32_t i = 0; i < m_configurations.size (); i++)
+    {
+      const Configuration &configuration = m_configurations[i];
+      if (configuration.nStarted >= m_maxRuns || IsConverged (i))
+        {
+          continue;
+        }
+
+      // Configurations short of MinRuns first, the fewest runs and the most
+      // expensive first. Then the widest intervals, spread over the runs
+      // already on their way.
+      double score;
+      if (configuration.nStarted < m_minRuns)
+        {
+          score = 1e12 * (m_minRuns - configuration.nStarted) + configurations[i].cost;
+        }
+      else
+        {
+          // The interval shrinks as the square root of the runs: do not
+          // start more runs than the target needs
+          double distance = GetDistanceToTarget (i);
+          double nNeeded = std::ceil (configuration.nRuns * (distance * distance - 1));
+          if (configuration.nRunning >= std::max (nNeeded, 1.0))
+            {
+              continue;
+            }
+          score = distance / (1 + configuration.nRunning);
+        }
+      if (best < 0 || score > bestScore)
+        {
+          best = i;
+          bestScore = score;
+        }
+    }
+  return best;
+}
+
+int
+LoraReplicationRunner::Run (const std::vector<LoraSweepRunner::Job> &configurations,
+                            uint32_t &run)
+{
+  NS_LOG_FUNCTION (this << configurations.size ());
+
+  m_configurations.assign (configurations.size (), Configuration ());
+  for (uint32_t i = 0; i < m_configurations.size (); i++)
+    {
+      m_configurations[i].metrics.resize (m_nMetrics);
+    }
+
+  // Output written by the parent must not be flushed again by each child
+  std::fflush (0);
+
+  struct Child
+  {
+    uint32_t configuration;
+    int reportFd;
+  };
+  std::map<pid_t, Child> running;
+
+  while (true)
+    {
+      int next;
+      while (running.size () < m_nWorkers && (next = PickNext (configurations)) >= 0)
+        {
+          Configuration &configuration = m_configurations[next];
+          int fds[2];
+          if (pipe (fds) != 0)
+            {
+              NS_FATAL_ERROR ("Cannot create a replication pipe");
+            }
+          pid_t pid = fork ();
+          if (pid < 0)
+            {
+              NS_FATAL_ERROR ("Cannot fork a replication");
+            }
+          if (pid == 0)
+            {
+              close (fds[0]);
+              m_reportFd = fds[1];
+              run = m_firstRun + configuration.nStarted;
+              return next;
+            }
+          close (fds[1]);
+          NS_LOG_INFO ("Configuration " << next << ", run " <<
+                       m_firstRun + configuration.nStarted << " in process " << pid);
+          configuration.nStarted++;
+          configuration.nRunning++;
+          Child child = {uint32_t (next), fds[0]};
+          running[pid] = child;
+        }
+
+      if (running.empty ())
+        {
+          break;
+        }
+
+      int status;
+      pid_t pid = waitpid (-1, &status, 0);
+      if (pid < 0)
+        {
+          NS_FATAL_ERROR ("Lost track of the replications");
+        }
+      std::map<pid_t, Child>::iterator it = running.find (pid);
+      if (it == running.end ())
+        {
+          continue;
+        }
+
+      // The report is far smaller than the pipe buffer, so the child could
+      // write it all before exiting
+      Configuration &configuration = m_configurations[it->second.configuration];
+      configuration.nRunning--;
+      std::vector<double> metrics (m_nMetrics);
+      ssize_t size = read (it->second.reportFd, metrics.data (), m_nMetrics * sizeof (double));
+      close (it->second.reportFd);
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0
+          || size != ssize_t (m_nMetrics * sizeof (double)))
+        {
+          NS_LOG_WARN ("Replication process " << pid << " failed");
+          m_nFailed++;
+        }
+      else
+        {
+          configuration.nRuns++;
+          for (uint32_t metric = 0; metric < m_nMetrics; metric++)
+            {
+              // Welford's update, skipping undefined values
+              double value = metrics[metric];
+              if (value != value)
+                {
+                  continue;
+                }
+              Statistics &statistics = configuration.metrics[metric];
+              statistics.n++;
+              double delta = value - statistics.mean;
+              statistics.mean += delta / statistics.n;
+              statistics.m2 += delta * (value - statistics.mean);
+            }
+          NS_LOG_DEBUG ("Configuration " << it->second.configuration << ": " <<
+                        configuration.nRuns << " runs, distance to target " <<
+                        GetDistanceToTarget (it->second.configuration));
+        }
+      running.erase (it);
+    }
+
+  return -1;
+}
+
+void
+LoraReplicationRunner::Report (const std::vector<double> &metrics)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_reportFd < 0 || metrics.size () != m_nMetrics)
+    {
+      return;
+    }
+  if (write (m_reportFd, metrics.data (), m_nMetrics * sizeof (double))
+      != ssize_t (m_nMetrics * sizeof (double)))
+    {
+      NS_LOG_WARN ("Cannot report the metrics of the run");
+    }
+  close (m_reportFd);
+  m_reportFd = -1;
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,171 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_REPLICATION_RUNNER_H
+#define LORA_REPLICATION_RUNNER_H
+
+#include "ns3/lora-sweep-runner.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Runs independent replications (runs with different RngSeedManager run
+ * numbers) of the configurations of a sweep, in parallel, until the mean
+ * of every output metric is known well enough.
+ *
+ * Like LoraSweepRunner, the runner forks one child per run. The child runs
+ * the simulation and sends its metrics back with Report, through a pipe.
+ * The parent keeps the running mean and variance of each metric of each
+ * configuration (Welford), and considers a configuration converged once it
+ * has at least MinRuns runs and the half-width of the confidence interval
+ * of every metric is below a fraction of its mean (or below the fraction
+ * itself, for a mean of 0).
+ *
+ * Free workers first go to configurations with fewer than MinRuns runs,
+ * then to the configuration whose widest interval is the furthest from
+ * the target, so that cores freed by converged configurations are spent
+ * on the noisy ones. No configuration gets more than MaxRuns runs.
+ */
+class LoraReplicationRunner
+{
+public:
+  /**
+   * \param nWorkers The maximum number of runs at the same time, or 0 for
+   * one per online processor.
+   * \param nMetrics The number of metrics each run reports.
+   */
+  LoraReplicationRunner (uint32_t nWorkers, uint32_t nMetrics);
+
+  /**
+   * \param relativeHalfWidth The target half-width of the confidence
+   * intervals, as a fraction of the mean.
+   * \param confidence The confidence level of the intervals.
+   */
+  void SetTarget (double relativeHalfWidth, double confidence);
+
+  /**
+   * \param minRuns The number of runs before a configuration can converge.
+   * \param maxRuns The maximum number of runs of a configuration.
+   * \param firstRun The run number of the first run of each configuration.
+   */
+  void SetRuns (uint32_t minRuns, uint32_t maxRuns, uint32_t firstRun);
+
+  /**
+   * Run the replications.
+   *
+   * Like fork, this function returns in several processes. In each child,
+   * it returns the index of the configuration to run, and sets run to the
+   * run number to use; the child then calls Report before exiting. In the
+   * parent, it returns -1 once all the configurations have converged or
+   * reached MaxRuns.
+   */
+  int Run (const std::vector<LoraSweepRunner::Job> &configurations, uint32_t &run);
+
+  /**
+   * In a child, send the metrics of its run to the parent.
+   */
+  void Report (const std::vector<double> &metrics);
+
+  /**
+   * \return The number of runs of a configuration that reported.
+   */
+  uint32_t GetNRuns (uint32_t configuration) const;
+
+  /**
+   * \return The mean of a metric over the runs of a configuration.
+   */
+  double GetMean (uint32_t configuration, uint32_t metric) const;
+
+  /**
+   * \return The half-width of the confidence interval of the mean.
+   */
+  double GetHalfWidth (uint32_t configuration, uint32_t metric) const;
+
+  /**
+   * \return Whether the intervals of a configuration reached the target.
+   */
+  bool IsConverged (uint32_t configuration) const;
+
+  /**
+   * \return The number of runs that did not report.
+   */
+  uint32_t GetNFailed (void) const;
+
+  /**
+   * Get a quantile of the Student t distribution, with the Cornish-Fisher
+   * expansion around the normal quantile (within 3% for 2 degrees of
+   * freedom, and closer for more).
+   *
+   * \param p The probability.
+   * \param dof The degrees of freedom.
+   */
+  static double GetStudentQuantile (double p, uint32_t dof);
+
+private:
+  /**
+   * Running statistics of a metric.
+   */
+  struct Statistics
+  {
+    uint32_t n = 0;
+    double mean = 0;
+    double m2 = 0;   //!< Sum of the squared deviations from the mean
+  };
+
+  /**
+   * What the runner knows about a configuration.
+   */
+  struct Configuration
+  {
+    std::vector<Statistics> metrics;
+    uint32_t nStarted = 0;   //!< Runs started, including those that failed
+    uint32_t nRunning = 0;
+    uint32_t nRuns = 0;      //!< Runs that reported
+  };
+
+  /**
+   * Pick the configuration of the next run.
+   *
+   * \return The configuration, or -1 if none needs more runs.
+   */
+  int PickNext (const std::vector<LoraSweepRunner::Job> &configurations) const;
+
+  /**
+   * \return How far the widest interval of a configuration is from the
+   * target: 1 on the target, more above.
+   */
+  double GetDistanceToTarget (uint32_t configuration) const;
+
+  uint32_t m_nWorkers;
+  uint32_t m_nMetrics;
+  double m_relativeHalfWidth;
+  double m_confidence;
+  uint32_t m_minRuns;
+  uint32_t m_maxRuns;
+  uint32_t m_firstRun;
+  uint32_t m_nFailed;
+  int m_reportFd;               //!< In a child, the pipe to the parent
+  std::vector<Configuration> m_configurations;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_REPLICATION_RUNNER_H */
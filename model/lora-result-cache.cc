@@ -0,0 +1,411 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-result-cache.h"
+#include "ns3/log.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <dlfcn.h>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraResultCache");
+
+namespace {
+
+const char INDEX_MAGIC[8] = {'L', 'O', 'R', 'A', 'C', 'A', 'C', '1'};
+
+// Slots of a new index
+const uint64_t INITIAL_SLOTS = 1024;
+
+bool
+ReadAll (int fd, void *data, std::size_t size, uint64_t offset)
+{
+  return pread (fd, data, size, offset) == ssize_t (size);
+}
+
+bool
+WriteAll (int fd, const void *data, std::size_t size, uint64_t offset)
+{
+  return pwrite (fd, data, size, offset) == ssize_t (size);
+}
+
+// FNV-1a over a block of bytes, to be continued with the next block
+uint64_t
+Fnv1a (uint64_t hash, const char *data, std::size_t size)
+{
+  for (std::size_t i = 0; i < size; i++)
+    {
+      hash ^= static_cast<unsigned char> (data[i]);
+      hash *= 1099511628211ULL;
+    }
+  return hash;
+}
+
+// The splitmix64 finalizer, to spread a hash over all the bits
+uint64_t
+Mix (uint64_t hash)
+{
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+// The hash of the contents of a file, or 0 if it cannot be read
+uint64_t
+HashFile (const std::string &fileName)
+{
+  int fd = open (fileName.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return 0;
+    }
+  uint64_t hash = 14695981039346656037ULL;
+  std::vector<char> block (1 << 16);
+  ssize_t n;
+  while ((n = read (fd, block.data (), block.size ())) > 0)
+    {
+      hash = Fnv1a (hash, block.data (), n);
+    }
+  close (fd);
+  return n == 0 ? Mix (hash) : 0;
+}
+
+std::string
+GetRealPath (const std::string &fileName)
+{
+  char path[PATH_MAX];
+  return realpath (fileName.c_str (), path) ? std::string (path) : fileName;
+}
+
+} // namespace
+
+LoraResultCache::LoraResultCache (const std::string &directory)
+  : m_directory (directory),
+  m_lockFd (-1)
+{
+  NS_LOG_FUNCTION (this << directory);
+
+  mkdir (m_directory.c_str (), 0755);
+  m_lockFd = open ((m_directory + "/lock").c_str (), O_RDWR | O_CREAT, 0644);
+  if (m_lockFd < 0)
+    {
+      NS_LOG_WARN ("Cannot open the result cache in " << m_directory << ": " <<
+                   std::strerror (errno));
+    }
+}
+
+LoraResultCache::~LoraResultCache ()
+{
+  if (m_lockFd >= 0)
+    {
+      close (m_lockFd);
+    }
+}
+
+uint64_t
+LoraResultCache::Hash (const std::string &config)
+{
+  // FNV-1a, then the splitmix64 finalizer to spread it over all the bits
+  uint64_t hash = Mix (Fnv1a (14695981039346656037ULL, config.data (), config.size ()));
+
+  // 0 marks the empty slots
+  return hash ? hash : 1;
+}
+
+std::string
+LoraResultCache::GetBuildId (void)
+{
+#ifdef LORAWAN_BUILD_ID
+  return LORAWAN_BUILD_ID;
+#else
+  // The contents of the library this module is linked in and of the
+  // program change with their code, but not when the same code is built
+  // again. They are hashed once per process.
+  static std::string buildId;
+  if (buildId.empty ())
+    {
+      std::string program = GetRealPath ("/proc/self/exe");
+      std::string library = program;
+      Dl_info info;
+      if (dladdr (reinterpret_cast<void *> (&LoraResultCache::GetBuildId), &info)
+          && info.dli_fname)
+        {
+          library = GetRealPath (info.dli_fname);
+        }
+
+      std::ostringstream id;
+      id << std::hex << HashFile (library);
+      if (library != program)
+        {
+          id << "-" << HashFile (program);
+        }
+      buildId = id.str ();
+      NS_LOG_DEBUG ("Build id " << buildId << " from " << library << " and " << program);
+    }
+  return buildId;
+#endif
+}
+
+bool
+LoraResultCache::Find (const std::string &config, std::vector<double> &row) const
+{
+  int indexFd = open ((m_directory + "/index").c_str (), O_RDONLY);
+  if (indexFd < 0)
+    {
+      return false;
+    }
+  int rowsFd = open ((m_directory + "/rows").c_str (), O_RDONLY);
+
+  bool found = false;
+  IndexHeader header;
+  if (rowsFd >= 0 && ReadAll (indexFd, &header, sizeof (header), 0)
+      && std::memcmp (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) == 0
+      && header.nSlots > 0)
+    {
+      uint64_t hash = Hash (config);
+      uint64_t slotIndex = hash % header.nSlots;
+      for (uint64_t probe = 0; probe < header.nSlots && !found; probe++)
+        {
+          Slot slot;
+          if (!ReadAll (indexFd, &slot, sizeof (slot),
+                        sizeof (header) + slotIndex * sizeof (slot))
+              || slot.hash == 0)
+            {
+              break;
+            }
+          slotIndex = (slotIndex + 1) % header.nSlots;
+          if (slot.hash != hash)
+            {
+              continue;
+            }
+
+          // Record: configuration size, configuration, row size, row
+          std::string record (slot.size, '\0');
+          uint32_t configSize;
+          uint32_t rowSize;
+          if (!ReadAll (rowsFd, &record[0], record.size (), slot.offset)
+              || record.size () < 2 * sizeof (uint32_t))
+            {
+              continue;
+            }
+          std::memcpy (&configSize, record.data (), sizeof (configSize));
+          if (configSize != config.size ()
+              || record.size () < 2 * sizeof (uint32_t) + configSize
+              || record.compare (sizeof (configSize), configSize, config) != 0)
+            {
+              continue;
+            }
+          std::memcpy (&rowSize, record.data () + sizeof (configSize) + configSize,
+                       sizeof (rowSize));
+          if (record.size () != 2 * sizeof (uint32_t) + configSize + rowSize * sizeof (double))
+            {
+              continue;
+            }
+          row.resize (rowSize);
+          std::memcpy (row.data (), record.data () + 2 * sizeof (uint32_t) + configSize,
+                       rowSize * sizeof (double));
+          found = true;
+        }
+    }
+
+  if (rowsFd >= 0)
+    {
+      close (rowsFd);
+    }
+  close (indexFd);
+  return found;
+}
+
+bool
+LoraResultCache::Lookup (const std::string &config, std::vector<double> &row)
+{
+  NS_LOG_FUNCTION (this);
+
+  bool found = false;
+  if (m_lockFd >= 0)
+    {
+      flock (m_lockFd, LOCK_SH);
+      found = Find (config, row);
+      flock (m_lockFd, LOCK_UN);
+    }
+
+  NS_LOG_DEBUG ((found ? "Hit " : "Miss ") << Hash (config));
+  return found;
+}
+
+bool
+LoraResultCache::Grow (const IndexHeader &header)
+{
+  std::string indexName = m_directory + "/index";
+  int indexFd = open (indexName.c_str (), O_RDONLY);
+  if (indexFd < 0)
+    {
+      return false;
+    }
+
+  IndexHeader newHeader = header;
+  newHeader.nSlots = 2 * header.nSlots;
+  std::vector<Slot> slots (newHeader.nSlots);
+  std::memset (slots.data (), 0, slots.size () * sizeof (Slot));
+
+  std::vector<Slot> chunk (4096);
+  bool ok = true;
+  for (uint64_t first = 0; first < header.nSlots && ok; first += chunk.size ())
+    {
+      uint64_t n = std::min<uint64_t> (chunk.size (), header.nSlots - first);
+      ok = ReadAll (indexFd, chunk.data (), n * sizeof (Slot),
+                    sizeof (header) + first * sizeof (Slot));
+      for (uint64_t i = 0; ok && i < n; i++)
+        {
+          if (chunk[i].hash == 0)
+            {
+              continue;
+            }
+          uint64_t slotIndex = chunk[i].hash % newHeader.nSlots;
+          while (slots[slotIndex].hash != 0)
+            {
+              slotIndex = (slotIndex + 1) % newHeader.nSlots;
+            }
+          slots[slotIndex] = chunk[i];
+        }
+    }
+  close (indexFd);
+
+  // Readers keep the old index until they reopen it
+  std::string newName = indexName + ".new";
+  int newFd = open (newName.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ok = ok && newFd >= 0
+    && WriteAll (newFd, &newHeader, sizeof (newHeader), 0)
+    && WriteAll (newFd, slots.data (), slots.size () * sizeof (Slot), sizeof (newHeader));
+  if (newFd >= 0)
+    {
+      close (newFd);
+    }
+  ok = ok && std::rename (newName.c_str (), indexName.c_str ()) == 0;
+
+  NS_LOG_DEBUG ("Index grown to " << newHeader.nSlots << " slots: " << ok);
+  return ok;
+}
+
+bool
+LoraResultCache::Store (const std::string &config, const std::vector<double> &row)
+{
+  NS_LOG_FUNCTION (this);
+
+  if (m_lockFd < 0)
+    {
+      return false;
+    }
+  flock (m_lockFd, LOCK_EX);
+
+  std::vector<double> cachedRow;
+  bool ok = true;
+  if (!Find (config, cachedRow))
+    {
+      std::string indexName = m_directory + "/index";
+      int indexFd = open (indexName.c_str (), O_RDWR);
+      if (indexFd < 0)
+        {
+          IndexHeader header;
+          std::memcpy (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC));
+          header.nSlots = INITIAL_SLOTS;
+          header.nEntries = 0;
+          indexFd = open (indexName.c_str (), O_RDWR | O_CREAT, 0644);
+          ok = indexFd >= 0
+            && ftruncate (indexFd, sizeof (header) + INITIAL_SLOTS * sizeof (Slot)) == 0
+            && WriteAll (indexFd, &header, sizeof (header), 0);
+        }
+
+      IndexHeader header;
+      ok = ok && ReadAll (indexFd, &header, sizeof (header), 0);
+      if (ok && 2 * (header.nEntries + 1) > header.nSlots)
+        {
+          close (indexFd);
+          ok = Grow (header);
+          indexFd = open (indexName.c_str (), O_RDWR);
+          ok = ok && indexFd >= 0 && ReadAll (indexFd, &header, sizeof (header), 0);
+        }
+
+      // The record first, so that a slot never points past the end of rows
+      std::string record;
+      uint32_t configSize = config.size ();
+      uint32_t rowSize = row.size ();
+      record.append (reinterpret_cast<const char *> (&configSize), sizeof (configSize));
+      record.append (config);
+      record.append (reinterpret_cast<const char *> (&rowSize), sizeof (rowSize));
+      record.append (reinterpret_cast<const char *> (row.data ()), row.size () * sizeof (double));
+
+      int rowsFd = open ((m_directory + "/rows").c_str (), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      struct stat info;
+      ok = ok && rowsFd >= 0 && fstat (rowsFd, &info) == 0
+        && write (rowsFd, record.data (), record.size ()) == ssize_t (record.size ());
+
+      if (ok)
+        {
+          Slot slot;
+          slot.hash = Hash (config);
+          slot.offset = info.st_size;
+          slot.size = record.size ();
+
+          uint64_t slotIndex = slot.hash % header.nSlots;
+          Slot probe;
+          while ((ok = ReadAll (indexFd, &probe, sizeof (probe),
+                                sizeof (header) + slotIndex * sizeof (Slot)))
+                 && probe.hash != 0)
+            {
+              slotIndex = (slotIndex + 1) % header.nSlots;
+            }
+          header.nEntries++;
+          ok = ok && WriteAll (indexFd, &slot, sizeof (slot),
+                               sizeof (header) + slotIndex * sizeof (Slot))
+            && WriteAll (indexFd, &header, sizeof (header), 0);
+        }
+
+      if (rowsFd >= 0)
+        {
+          close (rowsFd);
+        }
+      if (indexFd >= 0)
+        {
+          close (indexFd);
+        }
+    }
+
+  flock (m_lockFd, LOCK_UN);
+
+  if (!ok)
+    {
+      NS_LOG_WARN ("Cannot store in the result cache " << m_directory);
+    }
+  return ok;
+}
+
+} // namespace lorawan
+} // namespace ns3
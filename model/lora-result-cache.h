@@ -0,0 +1,132 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_RESULT_CACHE_H
+#define LORA_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Local cache of the result rows of simulation runs, addressed by the full
+ * configuration of the run.
+ *
+ * The configuration is a string holding every parameter that can change
+ * the result: command line values, seed and run, and the build id of the
+ * code (GetBuildId). A run whose configuration is in the cache does not
+ * need to be simulated again: its row is read back instead.
+ *
+ * The cache is a directory with three files:
+ *  - rows: the records, appended one after the other. A record holds the
+ *    configuration, so that a hash collision is never taken for a hit, and
+ *    the row as doubles.
+ *  - index: an open-addressing hash table from the 64-bit hash of the
+ *    configuration to the offset of its record in rows. A lookup reads the
+ *    header and, on average, fewer than two slots, whatever the number of
+ *    entries; the table doubles when it gets half full.
+ *  - lock: flock'ed shared by lookups and exclusive by stores, so that the
+ *    runs of a sweep can use the same cache.
+ *
+ * Rows need not have the same length: other values of a run, such as a
+ * table, can be stored under a configuration of their own.
+ */
+class LoraResultCache
+{
+public:
+  /**
+   * \param directory The cache directory, created if needed.
+   */
+  LoraResultCache (const std::string &directory);
+
+  ~LoraResultCache ();
+
+  /**
+   * Look up the row of a configuration.
+   *
+   * \param config The configuration.
+   * \param row The cached row, on a hit.
+   * \return Whether the configuration is in the cache.
+   */
+  bool Lookup (const std::string &config, std::vector<double> &row);
+
+  /**
+   * Store the row of a configuration.
+   *
+   * \param config The configuration.
+   * \param row The result row.
+   * \return Whether the row was stored.
+   */
+  bool Store (const std::string &config, const std::vector<double> &row);
+
+  /**
+   * \return An id that changes with the code of this module and of the
+   * program, to be part of the configurations: the hash of the contents of
+   * the library the module is linked in and of the program, or the
+   * LORAWAN_BUILD_ID macro if the build defines it (e.g., a version
+   * string).
+   */
+  static std::string GetBuildId (void);
+
+  /**
+   * \return The 64-bit hash of a configuration, never 0.
+   */
+  static uint64_t Hash (const std::string &config);
+
+private:
+  /**
+   * A slot of the index: 0, or the hash of a configuration and the
+   * position of its record.
+   */
+  struct Slot
+  {
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  /**
+   * The header of the index.
+   */
+  struct IndexHeader
+  {
+    char magic[8];
+    uint64_t nSlots;
+    uint64_t nEntries;
+  };
+
+  /**
+   * Read the record of a configuration. The lock must be held.
+   */
+  bool Find (const std::string &config, std::vector<double> &row) const;
+
+  /**
+   * Rewrite the index with twice the slots. The lock must be held
+   * exclusively.
+   */
+  bool Grow (const IndexHeader &header);
+
+  std::string m_directory;
+  int m_lockFd;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_RESULT_CACHE_H */
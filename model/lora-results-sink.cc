@@ -0,0 +1,144 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-results-sink.h"
+#include "ns3/log.h"
+#include "ns3/fatal-error.h"
+#include "ns3/assert.h"
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraResultsSink");
+
+LoraResultsSink::LoraResultsSink (const std::vector<std::string> &columns,
+                                  LoraTableWriter::Format format)
+  : m_columns (columns),
+  m_format (format),
+  m_values (columns.size ()),
+  m_isSet (columns.size (), false)
+{
+}
+
+uint32_t
+LoraResultsSink::GetColumnIndex (const std::string &column) const
+{
+  for (uint32_t i = 0; i < m_columns.size (); i++)
+    {
+      if (m_columns[i] == column)
+        {
+          return i;
+        }
+    }
+  NS_FATAL_ERROR ("No results column named " << column);
+  return 0;
+}
+
+void
+LoraResultsSink::Set (const std::string &column, double value)
+{
+  uint32_t index = GetColumnIndex (column);
+  m_values[index] = value;
+  m_isSet[index] = true;
+}
+
+uint32_t
+LoraResultsSink::SetFromText (const std::string &firstColumn,
+                              const std::string &values)
+{
+  uint32_t index = GetColumnIndex (firstColumn);
+  uint32_t nSet = 0;
+
+  const char *text = values.c_str ();
+  while (*text && index < m_columns.size ())
+    {
+      if (*text == ',' || std::isspace (static_cast<unsigned char> (*text)))
+        {
+          text++;
+          continue;
+        }
+      char *end;
+      double value = std::strtod (text, &end);
+      if (end == text)
+        {
+          NS_LOG_WARN ("Not a number in results: " << text);
+          break;
+        }
+      m_values[index] = value;
+      m_isSet[index] = true;
+      index++;
+      nSet++;
+      text = end;
+    }
+
+  return nSet;
+}
+
+std::vector<double>
+LoraResultsSink::GetRow (void) const
+{
+  std::vector<double> row (m_columns.size (), std::numeric_limits<double>::quiet_NaN ());
+  for (uint32_t i = 0; i < m_columns.size (); i++)
+    {
+      if (m_isSet[i])
+        {
+          row[i] = m_values[i];
+        }
+    }
+  return row;
+}
+
+void
+LoraResultsSink::SetRow (const std::vector<double> &row)
+{
+  NS_ASSERT (row.size () == m_columns.size ());
+  for (uint32_t i = 0; i < m_columns.size (); i++)
+    {
+      m_values[i] = row[i];
+      m_isSet[i] = row[i] == row[i];
+    }
+}
+
+bool
+LoraResultsSink::Commit (const std::string &fileName)
+{
+  NS_LOG_FUNCTION (this << fileName);
+
+  // A row is far smaller than the buffer, so it goes out in one write
+  LoraTableWriter table (fileName, m_columns, m_format, 4096);
+  for (uint32_t i = 0; i < m_columns.size (); i++)
+    {
+      if (m_isSet[i])
+        {
+          table.Add (m_values[i]);
+        }
+      else
+        {
+          table.AddEmpty ();
+        }
+    }
+
+  // Start a new row, whatever happens to this one
+  m_isSet.assign (m_columns.size (), false);
+
+  return table.Close ();
+}
+
+} // namespace lorawan
+} // namespace ns3
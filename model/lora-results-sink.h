@@ -0,0 +1,97 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_RESULTS_SINK_H
+#define LORA_RESULTS_SINK_H
+
+#include "ns3/lora-table-writer.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Writes the result row of a simulation run to a file shared by many runs.
+ *
+ * The columns are fixed when the sink is created. Values are kept in memory
+ * until Commit, which appends the whole row to the table with a single
+ * write, under the lock of a LoraTableWriter. Runs of a sweep can thus
+ * write to the same file at the same time, and a run that crashes before
+ * Commit leaves no partial row behind. The file formats are those of
+ * LoraTableWriter.
+ */
+class LoraResultsSink
+{
+public:
+  /**
+   * \param columns The column names, in order.
+   * \param format The format of the file.
+   */
+  LoraResultsSink (const std::vector<std::string> &columns,
+                   LoraTableWriter::Format format);
+
+  /**
+   * Set a value of the current row.
+   */
+  void Set (const std::string &column, double value);
+
+  /**
+   * Set consecutive values of the current row from a list of numbers
+   * separated by commas or whitespace, such as the output of a tool that
+   * writes its own columns.
+   *
+   * \param firstColumn The column of the first number.
+   * \param values The numbers.
+   * \return The number of values set.
+   */
+  uint32_t SetFromText (const std::string &firstColumn, const std::string &values);
+
+  /**
+   * \return The current row, with NaN for the values not set.
+   */
+  std::vector<double> GetRow (void) const;
+
+  /**
+   * Set the whole current row, as returned by GetRow.
+   */
+  void SetRow (const std::vector<double> &row);
+
+  /**
+   * Append the current row to a file, creating it if needed, and start a
+   * new row.
+   *
+   * \return Whether the row was written.
+   */
+  bool Commit (const std::string &fileName);
+
+private:
+  /**
+   * Get the index of a column, which must exist.
+   */
+  uint32_t GetColumnIndex (const std::string &column) const;
+
+  std::vector<std::string> m_columns;
+  LoraTableWriter::Format m_format;
+  std::vector<double> m_values;      //!< The current row
+  std::vector<bool> m_isSet;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_RESULTS_SINK_H */
@@ -0,0 +1,245 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-sweep-runner.h"
+#include "ns3/log.h"
+#include "ns3/fatal-error.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraSweepRunner");
+
+double
+LoraSweepRunner::Job::GetValue (const std::string &name, double defaultValue) const
+{
+  std::string prefix = "--" + name + "=";
+  for (std::vector<std::string>::const_iterator it = args.begin ();
+       it != args.end (); ++it)
+    {
+      if (it->compare (0, prefix.size (), prefix) == 0)
+        {
+          return std::atof (it->c_str () + prefix.size ());
+        }
+    }
+  return defaultValue;
+}
+
+std::vector<LoraSweepRunner::Job>
+LoraSweepRunner::ParseGrid (const std::string &spec)
+{
+  std::vector<Job> jobs (1);
+
+  std::istringstream entries (spec);
+  std::string entry;
+  while (std::getline (entries, entry, ';'))
+    {
+      if (entry.empty ())
+        {
+          continue;
+        }
+      std::size_t equal = entry.find ('=');
+      if (equal == std::string::npos)
+        {
+          NS_FATAL_ERROR ("Sweep entry without a value: " << entry);
+        }
+      std::string name = entry.substr (0, equal);
+      std::string values = entry.substr (equal + 1);
+
+      std::vector<std::string> expanded;
+      if (values.find (':') != std::string::npos)
+        {
+          long first = 0, last = 0, step = 1;
+          if (std::sscanf (values.c_str (), "%ld:%ld:%ld", &first, &last, &step) < 2
+              || step <= 0)
+            {
+              NS_FATAL_ERROR ("Bad sweep range: " << entry);
+            }
+          for (long v = first; v <= last; v += step)
+            {
+              std::ostringstream value;
+              value << v;
+              expanded.push_back (value.str ());
+            }
+        }
+      else
+        {
+          std::istringstream list (values);
+          std::string value;
+          while (std::getline (list, value, ','))
+            {
+              expanded.push_back (value);
+            }
+        }
+
+      // Each point so far is combined with every value of this parameter
+      std::vector<Job> product;
+      for (std::vector<Job>::const_iterator job = jobs.begin ();
+           job != jobs.end (); ++job)
+        {
+          for (std::vector<std::string>::const_iterator value = expanded.begin ();
+               value != expanded.end (); ++value)
+            {
+              Job point = *job;
+              point.args.push_back ("--" + name + "=" + *value);
+              product.push_back (point);
+            }
+        }
+      jobs.swap (product);
+    }
+
+  return jobs;
+}
+
+std::vector<LoraSweepRunner::Job>
+LoraSweepRunner::ParseList (const std::string &fileName)
+{
+  std::ifstream file (fileName.c_str ());
+  if (!file)
+    {
+      NS_FATAL_ERROR ("Cannot open sweep list " << fileName);
+    }
+
+  std::vector<Job> jobs;
+  std::string line;
+  while (std::getline (file, line))
+    {
+      std::istringstream entries (line);
+      std::string entry;
+      Job point;
+      while (entries >> entry)
+        {
+          if (point.args.empty () && entry[0] == '#')
+            {
+              break;
+            }
+          point.args.push_back ("--" + entry);
+        }
+      if (!point.args.empty ())
+        {
+          jobs.push_back (point);
+        }
+    }
+
+  return jobs;
+}
+
+LoraSweepRunner::LoraSweepRunner (uint32_t nWorkers)
+  : m_nWorkers (nWorkers),
+  m_nFailed (0)
+{
+  if (m_nWorkers == 0)
+    {
+      long nProcessors = sysconf (_SC_NPROCESSORS_ONLN);
+      m_nWorkers = nProcessors > 0 ? nProcessors : 1;
+    }
+}
+
+int
+LoraSweepRunner::Run (const std::vector<Job> &jobs)
+{
+  NS_LOG_FUNCTION (this << jobs.size ());
+
+  // Most expensive points first
+  std::vector<uint32_t> order (jobs.size ());
+  for (uint32_t i = 0; i < order.size (); i++)
+    {
+      order[i] = i;
+    }
+  std::stable_sort (order.begin (), order.end (),
+                    [&jobs] (uint32_t a, uint32_t b)
+                    {
+                      return jobs[a].cost > jobs[b].cost;
+                    });
+
+  // Output written by the parent must not be flushed again by each child
+  std::fflush (0);
+
+  std::map<pid_t, uint32_t> running;     // Child process -> worker slot
+  std::vector<uint32_t> freeSlots;
+  for (uint32_t slot = m_nWorkers; slot > 0; slot--)
+    {
+      freeSlots.push_back (slot - 1);
+    }
+
+  std::size_t next = 0;
+  while (next < order.size () || !running.empty ())
+    {
+      while (next < order.size () && !freeSlots.empty ())
+        {
+          uint32_t slot = freeSlots.back ();
+          pid_t pid = fork ();
+          if (pid < 0)
+            {
+              NS_FATAL_ERROR ("Cannot fork a sweep worker");
+            }
+          if (pid == 0)
+            {
+              return order[next];
+            }
+          NS_LOG_INFO ("Point " << order[next] << " runs in process " << pid <<
+                       ", worker " << slot);
+          freeSlots.pop_back ();
+          running[pid] = slot;
+          next++;
+        }
+
+      int status;
+      pid_t pid = waitpid (-1, &status, 0);
+      if (pid < 0)
+        {
+          NS_FATAL_ERROR ("Lost track of the sweep workers");
+        }
+      std::map<pid_t, uint32_t>::iterator it = running.find (pid);
+      if (it == running.end ())
+        {
+          continue;
+        }
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        {
+          NS_LOG_WARN ("Sweep process " << pid << " failed");
+          m_nFailed++;
+        }
+      freeSlots.push_back (it->second);
+      running.erase (it);
+    }
+
+  return -1;
+}
+
+uint32_t
+LoraSweepRunner::GetNWorkers (void) const
+{
+  return m_nWorkers;
+}
+
+uint32_t
+LoraSweepRunner::GetNFailed (void) const
+{
+  return m_nFailed;
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,113 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_SWEEP_RUNNER_H
+#define LORA_SWEEP_RUNNER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Runs the points of a parameter sweep in parallel, one forked process per
+ * point.
+ *
+ * A point is a list of command line arguments ("--name=value") that
+ * override those of the sweep. ns-3 keeps global state (node list,
+ * simulator, RNG settings) that a second scenario in the same process would
+ * inherit, so every point runs in its own child process, forked from a
+ * parent that has not built anything yet.
+ *
+ * The parent keeps up to nWorkers children running and starts the next
+ * point as soon as one exits, most expensive points first, so that long
+ * runs do not end up alone at the tail of the sweep. The children write
+ * their results themselves, to the same file: see LoraResultsSink.
+ */
+class LoraSweepRunner
+{
+public:
+  /**
+   * A point of the sweep.
+   */
+  struct Job
+  {
+    std::vector<std::string> args;   //!< The "--name=value" overrides
+    double cost = 1;                 //!< Predicted cost, in arbitrary units
+
+    /**
+     * Get the value a point gives to a parameter.
+     *
+     * \param name The parameter name, without dashes.
+     * \param defaultValue The value if the point does not set it.
+     */
+    double GetValue (const std::string &name, double defaultValue) const;
+  };
+
+  /**
+   * Build the cartesian product of a grid.
+   *
+   * The spec is a ';'-separated list of "name=values" entries, where values
+   * are either a ','-separated list or an integer range "first:last" or
+   * "first:last:step". For example, "runSeed=1:10;txPowerdBm=2,8,14" has
+   * 30 points.
+   */
+  static std::vector<Job> ParseGrid (const std::string &spec);
+
+  /**
+   * Read a list of points from a file, one per line, each line holding
+   * whitespace-separated "name=value" entries. Empty lines and lines
+   * starting with '#' are skipped.
+   */
+  static std::vector<Job> ParseList (const std::string &fileName);
+
+  /**
+   * \param nWorkers The maximum number of points running at the same time,
+   * or 0 for one per online processor.
+   */
+  LoraSweepRunner (uint32_t nWorkers);
+
+  /**
+   * Run the points.
+   *
+   * Like fork, this function returns in several processes. In each child,
+   * it returns the index of the point to run, which the caller runs before
+   * exiting. In the parent, it returns -1 once all the children have exited.
+   */
+  int Run (const std::vector<Job> &jobs);
+
+  /**
+   * \return The number of worker slots.
+   */
+  uint32_t GetNWorkers (void) const;
+
+  /**
+   * \return In the parent, the number of children that did not exit
+   * successfully.
+   */
+  uint32_t GetNFailed (void) const;
+
+private:
+  uint32_t m_nWorkers;
+  uint32_t m_nFailed;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_SWEEP_RUNNER_H */
@@ -0,0 +1,285 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-table-writer.h"
+#include "ns3/log.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraTableWriter");
+
+namespace {
+
+const char BINARY_MAGIC[] = "LORARES1";
+
+// Longest text of a value, separator included
+const std::size_t MAX_FIELD_SIZE = 32;
+
+// Enough digits for integers such as seeds to be written exactly
+int
+FormatValue (char *text, double value)
+{
+  return std::snprintf (text, MAX_FIELD_SIZE, "%.15g", value);
+}
+
+} // namespace
+
+LoraTableWriter::LoraTableWriter (const std::string &fileName,
+                                  const std::vector<std::string> &columns,
+                                  Format format, uint32_t bufferSize)
+  : m_fileName (fileName),
+  m_format (format),
+  m_nColumns (columns.size ()),
+  m_column (0),
+  m_nRows (0),
+  m_fd (-1),
+  m_ok (true),
+  m_buffer (std::max<std::size_t> (bufferSize, 2 * MAX_FIELD_SIZE)),
+  m_used (0)
+{
+  NS_LOG_FUNCTION (this << fileName << bufferSize);
+
+  std::string header;
+  if (m_format == TEXT)
+    {
+      for (uint32_t i = 0; i < columns.size (); i++)
+        {
+          header += (i ? "," : "") + columns[i];
+        }
+    }
+  else
+    {
+      header.append (BINARY_MAGIC, sizeof (BINARY_MAGIC) - 1);
+      header.append (reinterpret_cast<const char *> (&m_nColumns), sizeof (m_nColumns));
+      for (uint32_t i = 0; i < columns.size (); i++)
+        {
+          uint16_t length = columns[i].size ();
+          header.append (reinterpret_cast<const char *> (&length), sizeof (length));
+          header.append (columns[i]);
+        }
+    }
+
+  m_fd = open (fileName.c_str (), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (m_fd < 0)
+    {
+      NS_LOG_WARN ("Cannot open " << fileName << ": " << std::strerror (errno));
+      m_ok = false;
+      return;
+    }
+
+  // Other runs wait until the table is complete. The lock goes away with
+  // the file descriptor, even if this process is killed.
+  while (flock (m_fd, LOCK_EX) != 0 && errno == EINTR)
+    {
+    }
+
+  struct stat info;
+  if (fstat (m_fd, &info) != 0)
+    {
+      m_ok = false;
+    }
+  else if (info.st_size == 0)
+    {
+      // The header goes out with the first rows
+      m_buffer.resize (std::max (m_buffer.size (), header.size () + 2 * MAX_FIELD_SIZE));
+      std::memcpy (m_buffer.data (), header.data (), header.size ());
+      m_used = header.size ();
+    }
+  else
+    {
+      // Do not mix rows of another schema into the file
+      std::string fileHeader (header.size (), '\0');
+      if (pread (m_fd, &fileHeader[0], fileHeader.size (), 0) != ssize_t (fileHeader.size ())
+          || fileHeader != header)
+        {
+          NS_LOG_WARN (fileName << " has other columns, table not written");
+          m_ok = false;
+        }
+    }
+
+  if (!m_ok)
+    {
+      close (m_fd);
+      m_fd = -1;
+    }
+}
+
+LoraTableWriter::~LoraTableWriter ()
+{
+  Close ();
+}
+
+void
+LoraTableWriter::BeginField (void)
+{
+  if (m_used + MAX_FIELD_SIZE > m_buffer.size ())
+    {
+      Flush ();
+    }
+  if (m_format == TEXT)
+    {
+      m_buffer[m_used++] = m_column ? ',' : '\n';
+    }
+}
+
+void
+LoraTableWriter::Add (double value)
+{
+  BeginField ();
+  if (m_format == TEXT)
+    {
+      m_used += FormatValue (&m_buffer[m_used], value);
+    }
+  else
+    {
+      std::memcpy (&m_buffer[m_used], &value, sizeof (value));
+      m_used += sizeof (value);
+    }
+  if (++m_column == m_nColumns)
+    {
+      m_column = 0;
+      m_nRows++;
+    }
+}
+
+void
+LoraTableWriter::AddEmpty (void)
+{
+  if (m_format == BINARY)
+    {
+      Add (std::numeric_limits<double>::quiet_NaN ());
+      return;
+    }
+  BeginField ();
+  if (++m_column == m_nColumns)
+    {
+      m_column = 0;
+      m_nRows++;
+    }
+}
+
+void
+LoraTableWriter::Flush (void)
+{
+  const char *data = m_buffer.data ();
+  std::size_t size = m_used;
+  m_used = 0;
+
+  while (m_fd >= 0 && size > 0)
+    {
+      ssize_t written = write (m_fd, data, size);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          NS_LOG_WARN ("Cannot write to " << m_fileName << ": " << std::strerror (errno));
+          m_ok = false;
+          return;
+        }
+      data += written;
+      size -= written;
+    }
+}
+
+bool
+LoraTableWriter::Close (void)
+{
+  if (m_fd < 0)
+    {
+      return m_ok;
+    }
+
+  NS_LOG_FUNCTION (this);
+
+  if (m_column != 0)
+    {
+      NS_LOG_WARN ("Incomplete row in " << m_fileName);
+    }
+  Flush ();
+  flock (m_fd, LOCK_UN);
+  close (m_fd);
+  m_fd = -1;
+  return m_ok;
+}
+
+uint64_t
+LoraTableWriter::GetNRows (void) const
+{
+  return m_nRows;
+}
+
+bool
+LoraTableWriter::ConvertToText (const std::string &binaryName,
+                                const std::string &textName)
+{
+  std::ifstream input (binaryName.c_str (), std::ifstream::binary);
+  char magic[sizeof (BINARY_MAGIC) - 1];
+  uint32_t nColumns = 0;
+  if (!input.read (magic, sizeof (magic))
+      || std::memcmp (magic, BINARY_MAGIC, sizeof (magic)) != 0
+      || !input.read (reinterpret_cast<char *> (&nColumns), sizeof (nColumns)))
+    {
+      return false;
+    }
+
+  std::vector<std::string> columns;
+  for (uint32_t i = 0; i < nColumns; i++)
+    {
+      uint16_t length = 0;
+      input.read (reinterpret_cast<char *> (&length), sizeof (length));
+      std::string name (length, '\0');
+      if (!input.read (&name[0], length))
+        {
+          return false;
+        }
+      columns.push_back (name);
+    }
+
+  LoraTableWriter output (textName, columns, TEXT);
+  std::vector<double> values (nColumns);
+  while (input.read (reinterpret_cast<char *> (values.data ()),
+                     nColumns * sizeof (double)))
+    {
+      for (uint32_t i = 0; i < nColumns; i++)
+        {
+          if (values[i] == values[i])
+            {
+              output.Add (values[i]);
+            }
+          else
+            {
+              output.AddEmpty ();
+            }
+        }
+    }
+
+  return output.Close ();
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,125 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_TABLE_WRITER_H
+#define LORA_TABLE_WRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Appends rows of numbers to a table file, through a large user-space
+ * buffer.
+ *
+ * Values are formatted into the buffer, which is written with a single
+ * write call whenever it fills up, instead of a flush per line. The file is
+ * opened with O_APPEND and kept under an exclusive flock until Close, so
+ * that tables written by concurrent runs do not interleave. The header is
+ * written if the file is empty; if the file has another header, nothing is
+ * written to it.
+ *
+ * In the TEXT format, the file is a comma-separated table: a header line
+ * and one line per row, each row starting with a newline. In the BINARY
+ * format, the file starts with the magic "LORARES1", the number of columns
+ * (uint32_t) and the column names (each a uint16_t length and the
+ * characters), and each row is one native double per column. ConvertToText
+ * turns it into the text table. Missing values are empty in text and NaN in
+ * binary.
+ */
+class LoraTableWriter
+{
+public:
+  enum Format
+  {
+    TEXT,
+    BINARY
+  };
+
+  /**
+   * Open a table, creating the file if needed.
+   *
+   * \param fileName The file to append to.
+   * \param columns The column names, in order.
+   * \param format The format of the file.
+   * \param bufferSize The size of the buffer, in bytes.
+   */
+  LoraTableWriter (const std::string &fileName,
+                   const std::vector<std::string> &columns,
+                   Format format, uint32_t bufferSize = 1 << 20);
+
+  ~LoraTableWriter ();
+
+  /**
+   * Add the next value of the current row. A row ends after a value has
+   * been added to each column.
+   */
+  void Add (double value);
+
+  /**
+   * Add a missing value to the current row.
+   */
+  void AddEmpty (void);
+
+  /**
+   * Write what is left in the buffer and release the file.
+   *
+   * \return Whether everything was written.
+   */
+  bool Close (void);
+
+  /**
+   * \return The number of complete rows added so far.
+   */
+  uint64_t GetNRows (void) const;
+
+  /**
+   * Append the rows of a binary table to a text table.
+   *
+   * \return Whether the binary file could be read.
+   */
+  static bool ConvertToText (const std::string &binaryName,
+                             const std::string &textName);
+
+private:
+  /**
+   * Start a field of the current row, and make room for its value.
+   */
+  void BeginField (void);
+
+  /**
+   * Write the buffer to the file.
+   */
+  void Flush (void);
+
+  std::string m_fileName;
+  Format m_format;
+  uint32_t m_nColumns;
+  uint32_t m_column;             //!< Column of the next value
+  uint64_t m_nRows;
+  int m_fd;                      //!< -1 once closed, or if the file is unusable
+  bool m_ok;
+  std::vector<char> m_buffer;
+  std::size_t m_used;            //!< Bytes of the buffer in use
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_TABLE_WRITER_H */
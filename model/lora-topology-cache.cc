@@ -0,0 +1,352 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/lora-topology-cache.h"
+#include "ns3/lora-result-cache.h"
+#include "ns3/lora-net-device.h"
+#include "ns3/end-device-lora-mac.h"
+#include "ns3/mobility-model.h"
+#include "ns3/log.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("LoraTopologyCache");
+
+namespace {
+
+const char TOPOLOGY_MAGIC[8] = {'L', 'O', 'R', 'A', 'T', 'O', 'P', '2'};
+
+// The file starts with the header, followed by the positions, the uplink
+// and downlink losses (doubles), the data rates, transmission powers and
+// spreading factors (bytes) and the configuration. The header keeps the
+// doubles aligned.
+struct Header
+{
+  char magic[8];
+  uint64_t hash;
+  uint32_t nDevices;
+  uint32_t nGateways;
+  uint32_t configSize;
+  uint32_t reserved;
+};
+
+struct Layout
+{
+  std::size_t positions;
+  std::size_t uplinkLoss;
+  std::size_t downlinkLoss;
+  std::size_t dataRates;
+  std::size_t txPowers;
+  std::size_t sfs;
+  std::size_t config;
+  std::size_t size;
+};
+
+Layout
+GetLayout (uint32_t nDevices, uint32_t nGateways, uint32_t configSize)
+{
+  std::size_t nLinks = std::size_t (nDevices) * nGateways;
+  Layout layout;
+  layout.positions = sizeof (Header);
+  layout.uplinkLoss = layout.positions + 3 * sizeof (double) * (std::size_t (nDevices) + nGateways);
+  layout.downlinkLoss = layout.uplinkLoss + sizeof (double) * nLinks;
+  layout.dataRates = layout.downlinkLoss + sizeof (double) * nLinks;
+  layout.txPowers = layout.dataRates + nDevices;
+  layout.sfs = layout.txPowers + nDevices;
+  layout.config = layout.sfs + nDevices;
+  layout.size = layout.config + configSize;
+  return layout;
+}
+
+Ptr<EndDeviceLoraMac>
+GetMac (Ptr<Node> node)
+{
+  return DynamicCast<LoraNetDevice> (node->GetDevice (0))->GetMac ()->GetObject<EndDeviceLoraMac> ();
+}
+
+Vector
+GetNodePosition (Ptr<Node> node)
+{
+  return node->GetObject<MobilityModel> ()->GetPosition ();
+}
+
+} // namespace
+
+LoraTopologyCache::LoraTopologyCache (const std::string &directory, const std::string &config)
+  : m_directory (directory),
+    m_config (config),
+    m_hash (LoraResultCache::Hash (config)),
+    m_map (0),
+    m_mapSize (0),
+    m_nDevices (0),
+    m_nGateways (0),
+    m_positions (0),
+    m_uplinkLoss (0),
+    m_downlinkLoss (0),
+    m_dataRates (0),
+    m_txPowers (0),
+    m_sfs (0)
+{
+  mkdir (m_directory.c_str (), 0755);
+}
+
+LoraTopologyCache::~LoraTopologyCache ()
+{
+  Close ();
+}
+
+std::string
+LoraTopologyCache::GetFileName (void) const
+{
+  std::ostringstream name;
+  name << m_directory << "/topology." << std::hex << m_hash << ".bin";
+  return name.str ();
+}
+
+bool
+LoraTopologyCache::Open (void)
+{
+  Close ();
+
+  std::string fileName = GetFileName ();
+  int fd = open (fileName.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && std::size_t (st.st_size) >= sizeof (Header))
+    {
+      map = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+      NS_LOG_WARN ("Cannot map the topology cache " << fileName);
+      return false;
+    }
+
+  // Only a complete file of this configuration is a hit
+  const char *image = static_cast<const char *> (map);
+  Header header;
+  std::memcpy (&header, image, sizeof (Header));
+  Layout layout = GetLayout (header.nDevices, header.nGateways, header.configSize);
+  if (std::memcmp (header.magic, TOPOLOGY_MAGIC, sizeof (TOPOLOGY_MAGIC)) != 0
+      || header.hash != m_hash || layout.size != std::size_t (st.st_size)
+      || m_config.compare (0, std::string::npos, image + layout.config, header.configSize) != 0)
+    {
+      NS_LOG_WARN ("Ignoring the topology cache " << fileName << ": not of this configuration");
+      munmap (map, st.st_size);
+      return false;
+    }
+
+  m_map = map;
+  m_mapSize = st.st_size;
+  SetImage (image);
+  NS_LOG_DEBUG ("Mapped the topology of " << m_nDevices << " devices and " <<
+                m_nGateways << " gateways from " << fileName);
+  return true;
+}
+
+void
+LoraTopologyCache::Build (NodeContainer endDevices, NodeContainer gateways,
+                          Ptr<PropagationLossModel> loss)
+{
+  NS_LOG_FUNCTION (this);
+
+  Close ();
+
+  uint32_t nDevices = endDevices.GetN ();
+  uint32_t nGateways = gateways.GetN ();
+  Layout layout = GetLayout (nDevices, nGateways, m_config.size ());
+  m_buffer.assign (layout.size, 0);
+
+  Header header;
+  std::memcpy (header.magic, TOPOLOGY_MAGIC, sizeof (TOPOLOGY_MAGIC));
+  header.hash = m_hash;
+  header.nDevices = nDevices;
+  header.nGateways = nGateways;
+  header.configSize = m_config.size ();
+  header.reserved = 0;
+  std::memcpy (m_buffer.data (), &header, sizeof (Header));
+  std::memcpy (m_buffer.data () + layout.config, m_config.data (), m_config.size ());
+
+  double *positions = reinterpret_cast<double *> (m_buffer.data () + layout.positions);
+  NodeContainer nodes (endDevices, gateways);
+  for (uint32_t i = 0; i < nodes.GetN (); i++)
+    {
+      Vector position = GetNodePosition (nodes.Get (i));
+      positions[3 * i] = position.x;
+      positions[3 * i + 1] = position.y;
+      positions[3 * i + 2] = position.z;
+    }
+
+  // The loss of a link is what the model takes off a transmission of 0 dBm
+  double *uplinkLoss = reinterpret_cast<double *> (m_buffer.data () + layout.uplinkLoss);
+  double *downlinkLoss = reinterpret_cast<double *> (m_buffer.data () + layout.downlinkLoss);
+  for (uint32_t i = 0; i < nDevices; i++)
+    {
+      Ptr<MobilityModel> device = endDevices.Get (i)->GetObject<MobilityModel> ();
+      for (uint32_t j = 0; j < nGateways; j++)
+        {
+          Ptr<MobilityModel> gateway = gateways.Get (j)->GetObject<MobilityModel> ();
+          uplinkLoss[i * nGateways + j] = -loss->CalcRxPower (0, device, gateway);
+          downlinkLoss[i * nGateways + j] = -loss->CalcRxPower (0, gateway, device);
+        }
+    }
+
+  SetImage (m_buffer.data ());
+}
+
+bool
+LoraTopologyCache::Store (NodeContainer endDevices)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT_MSG (!m_buffer.empty (), "Store needs a topology from Build");
+  NS_ASSERT (endDevices.GetN () == m_nDevices);
+
+  Layout layout = GetLayout (m_nDevices, m_nGateways, m_config.size ());
+  uint8_t *dataRates = reinterpret_cast<uint8_t *> (m_buffer.data () + layout.dataRates);
+  uint8_t *txPowers = reinterpret_cast<uint8_t *> (m_buffer.data () + layout.txPowers);
+  uint8_t *sfs = reinterpret_cast<uint8_t *> (m_buffer.data () + layout.sfs);
+  for (uint32_t i = 0; i < m_nDevices; i++)
+    {
+      Ptr<EndDeviceLoraMac> mac = GetMac (endDevices.Get (i));
+      dataRates[i] = mac->GetDataRate ();
+      txPowers[i] = mac->GetTransmissionPower ();
+      sfs[i] = mac->GetSf ();
+    }
+
+  // Every run of a sweep may store the same file: each one writes its own
+  // temporary file, and the last rename wins
+  std::string fileName = GetFileName ();
+  std::ostringstream temporary;
+  temporary << fileName << "." << getpid () << ".tmp";
+  int fd = open (temporary.str ().c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0;
+  std::size_t written = 0;
+  while (ok && written < m_buffer.size ())
+    {
+      ssize_t n = write (fd, m_buffer.data () + written, m_buffer.size () - written);
+      ok = n > 0;
+      written += ok ? n : 0;
+    }
+  if (fd >= 0)
+    {
+      ok = close (fd) == 0 && ok;
+    }
+  ok = ok && std::rename (temporary.str ().c_str (), fileName.c_str ()) == 0;
+  if (!ok)
+    {
+      NS_LOG_WARN ("Cannot write the topology cache " << fileName);
+      std::remove (temporary.str ().c_str ());
+    }
+  return ok;
+}
+
+void
+LoraTopologyCache::Apply (NodeContainer endDevices) const
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT (endDevices.GetN () == m_nDevices);
+
+  for (uint32_t i = 0; i < m_nDevices; i++)
+    {
+      Ptr<EndDeviceLoraMac> mac = GetMac (endDevices.Get (i));
+      mac->SetDataRate (m_dataRates[i]);
+      mac->SetTransmissionPower (m_txPowers[i]);
+      mac->SetSf (m_sfs[i]);
+    }
+}
+
+uint32_t
+LoraTopologyCache::GetNDevices (void) const
+{
+  return m_nDevices;
+}
+
+uint32_t
+LoraTopologyCache::GetNGateways (void) const
+{
+  return m_nGateways;
+}
+
+Vector
+LoraTopologyCache::GetPosition (uint32_t node) const
+{
+  NS_ASSERT (node < m_nDevices + m_nGateways);
+  return Vector (m_positions[3 * node], m_positions[3 * node + 1], m_positions[3 * node + 2]);
+}
+
+double
+LoraTopologyCache::GetUplinkLoss (uint32_t device, uint32_t gateway) const
+{
+  return m_uplinkLoss[device * m_nGateways + gateway];
+}
+
+double
+LoraTopologyCache::GetDownlinkLoss (uint32_t device, uint32_t gateway) const
+{
+  return m_downlinkLoss[device * m_nGateways + gateway];
+}
+
+void
+LoraTopologyCache::SetImage (const char *image)
+{
+  Header header;
+  std::memcpy (&header, image, sizeof (Header));
+  Layout layout = GetLayout (header.nDevices, header.nGateways, header.configSize);
+  m_nDevices = header.nDevices;
+  m_nGateways = header.nGateways;
+  m_positions = reinterpret_cast<const double *> (image + layout.positions);
+  m_uplinkLoss = reinterpret_cast<const double *> (image + layout.uplinkLoss);
+  m_downlinkLoss = reinterpret_cast<const double *> (image + layout.downlinkLoss);
+  m_dataRates = reinterpret_cast<const uint8_t *> (image + layout.dataRates);
+  m_txPowers = reinterpret_cast<const uint8_t *> (image + layout.txPowers);
+  m_sfs = reinterpret_cast<const uint8_t *> (image + layout.sfs);
+}
+
+void
+LoraTopologyCache::Close (void)
+{
+  if (m_map)
+    {
+      munmap (m_map, m_mapSize);
+      m_map = 0;
+      m_mapSize = 0;
+    }
+  m_buffer.clear ();
+  m_nDevices = 0;
+  m_nGateways = 0;
+  m_positions = 0;
+  m_uplinkLoss = 0;
+  m_downlinkLoss = 0;
+  m_dataRates = 0;
+  m_txPowers = 0;
+  m_sfs = 0;
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,146 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef LORA_TOPOLOGY_CACHE_H
+#define LORA_TOPOLOGY_CACHE_H
+
+#include "ns3/simple-ref-count.h"
+#include "ns3/node-container.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/vector.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * On-disk cache of the topology of a scenario: the positions of the nodes,
+ * the path loss of every link between an end device and a gateway, in both
+ * directions, and the data rate, transmission power and spreading factor
+ * the spreading factor assignment gave to each end device.
+ *
+ * The cache of a scenario is a single file, named after the hash of its
+ * configuration (the parameters the topology depends on and the build id
+ * of the code, see LoraResultCache), and holds the configuration itself so
+ * that a hash collision is never taken for a hit. The file is mapped in
+ * memory read-only, so that loading it costs nothing but the pages that are
+ * read, and the runs of a sweep share them. It is written through a
+ * temporary file and a rename, so that concurrent runs only ever see
+ * complete files.
+ *
+ * On a hit, the nodes are placed at the cached positions instead of drawing
+ * them, and Apply replaces the spreading factor assignment. On a miss, Build
+ * computes the link budget from the propagation loss model, and Store saves
+ * it, after the spreading factor assignment, for the next runs. Either way,
+ * CachedPropagationLossModel reads the link budget from here.
+ */
+class LoraTopologyCache : public SimpleRefCount<LoraTopologyCache>
+{
+public:
+  /**
+   * \param directory The cache directory, created if needed.
+   * \param config The configuration of the scenario.
+   */
+  LoraTopologyCache (const std::string &directory, const std::string &config);
+
+  ~LoraTopologyCache ();
+
+  /**
+   * \return The name of the cache file of the configuration.
+   */
+  std::string GetFileName (void) const;
+
+  /**
+   * Map the cache file of the configuration, if there is a valid one.
+   *
+   * \return Whether the file was mapped.
+   */
+  bool Open (void);
+
+  /**
+   * Compute the positions and the link budget of the scenario, in memory.
+   *
+   * \param loss The propagation loss model of the channel.
+   */
+  void Build (NodeContainer endDevices, NodeContainer gateways,
+              Ptr<PropagationLossModel> loss);
+
+  /**
+   * Save what Build computed and the data rate, transmission power and
+   * spreading factor of the end devices to the cache file.
+   *
+   * \return Whether the file was written.
+   */
+  bool Store (NodeContainer endDevices);
+
+  /**
+   * Give the end devices the data rate, transmission power and spreading
+   * factor of the cache, instead of running the spreading factor assignment.
+   */
+  void Apply (NodeContainer endDevices) const;
+
+  uint32_t GetNDevices (void) const;
+  uint32_t GetNGateways (void) const;
+
+  /**
+   * \return The position of a node: the end devices come first, then the
+   * gateways.
+   */
+  Vector GetPosition (uint32_t node) const;
+
+  /**
+   * \return The loss, in dB, from an end device to a gateway.
+   */
+  double GetUplinkLoss (uint32_t device, uint32_t gateway) const;
+
+  /**
+   * \return The loss, in dB, from a gateway to an end device.
+   */
+  double GetDownlinkLoss (uint32_t device, uint32_t gateway) const;
+
+private:
+  /**
+   * Point the accessors to a cache image, in memory or mapped.
+   */
+  void SetImage (const char *image);
+
+  /**
+   * Unmap the file or free the image.
+   */
+  void Close (void);
+
+  std::string m_directory;
+  std::string m_config;
+  uint64_t m_hash;
+  void *m_map;                    //!< The mapped file, or 0
+  std::size_t m_mapSize;
+  std::vector<char> m_buffer;     //!< The image being built, if not mapped
+  uint32_t m_nDevices;
+  uint32_t m_nGateways;
+  const double *m_positions;      //!< x, y, z of the devices, then gateways
+  const double *m_uplinkLoss;     //!< By device, then gateway
+  const double *m_downlinkLoss;
+  const uint8_t *m_dataRates;
+  const uint8_t *m_txPowers;
+  const uint8_t *m_sfs;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* LORA_TOPOLOGY_CACHE_H */
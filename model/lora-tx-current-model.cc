@@ -21,6 +21,7 @@
 #include "ns3/string.h"
 #include "ns3/pointer.h"
 #include <cmath>
+#include <algorithm>
 
 namespace ns3 {
 namespace lorawan {
@@ -242,11 +243,19 @@ SX1272LoRaWANCurrentModel::GetTypeId (void)
                    MakeBooleanAccessor (&SX1272LoRaWANCurrentModel::SetLnaBoost,
                                         &SX1272LoRaWANCurrentModel::GetLnaBoost),
                    MakeBooleanChecker ())
+    .AddAttribute ("TrackTxPower",
+                   "Whether the TX current of each frame is looked up in the "
+                   "table for the power it is sent with, instead of being "
+                   "fixed by TxCurrent or TxPowerToTxCurrent.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&SX1272LoRaWANCurrentModel::m_trackTxPower),
+                   MakeBooleanChecker ())
   ;
   return tid;
 }
 
 SX1272LoRaWANCurrentModel::SX1272LoRaWANCurrentModel ()
+  : m_trackTxPower (false)
 {
   NS_LOG_FUNCTION (this);
 }
@@ -263,6 +272,10 @@ double
 SX1272LoRaWANCurrentModel::CalcTxCurrent (double txPowerDbm) const
 {
   NS_LOG_FUNCTION (this << txPowerDbm);
+  if (m_trackTxPower && m_usePaBoost)
+    {
+      return GetPaBoostTxCurrent (txPowerDbm);
+    }
   return m_txCurrent;
 }
 
@@ -366,10 +379,7 @@ SX1272LoRaWANCurrentModel::SetTxCurrent (double txPowerDbm)
       txPowerDbm = 20;
     }
 
-    int ind = (int) txPowerDbm;
-    ind -= 2;
-
-    m_txCurrent =  m_txPowerUsePaBoost[ind];
+    m_txCurrent = GetPaBoostTxCurrent (txPowerDbm);
 
   }
   else
@@ -379,6 +389,18 @@ SX1272LoRaWANCurrentModel::SetTxCurrent (double txPowerDbm)
   }
 }
 
+double
+SX1272LoRaWANCurrentModel::GetPaBoostTxCurrent (double txPowerDbm)
+{
+  if (txPowerDbm == 18 || txPowerDbm == 19)
+    {
+      NS_FATAL_ERROR ("SX1272LoRaWANCurrentModel:18dBm and 19dBm are not measured on the paper.");
+    }
+  txPowerDbm = std::min (std::max (txPowerDbm, 2.0), 20.0);
+
+  return m_txPowerUsePaBoost[(int) txPowerDbm - 2];
+}
+
 void
 SX1272LoRaWANCurrentModel::SetTxCurrentDirectly(double tx_current)
 {
@@ -155,6 +155,14 @@ public:
    */
   void SetTxCurrentDirectly(double tx_current);
 
+  /**
+   * \param txPowerDbm (dBm)
+   *
+   * \return the TX current measured with the PaBoost pin at this power, from
+   * the table of the model. The power is clamped to the 2 to 20 dBm range.
+   */
+  static double GetPaBoostTxCurrent (double txPowerDbm);
+
   /**
    * \return the current in the TX state, which is dependent on the current TX Power and choice of PA circuitry.
    */
@@ -268,6 +276,8 @@ private:
   bool m_usePaBoost; // choice of whether to use PaBoost mode or not
 
   bool m_useLnaBoost; // choice of whether to use LnaBoost mode or not
+
+  bool m_trackTxPower; // whether CalcTxCurrent follows the power of each frame
   double m_txPowerdBm; // txPower who converts to txCurrent
 
 
@@ -0,0 +1,193 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/mac-command-pool.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+namespace lorawan {
+
+NS_LOG_COMPONENT_DEFINE ("MacCommandPool");
+
+//////////////////////
+// MacCommandBuffer //
+//////////////////////
+
+MacCommandBuffer::MacCommandBuffer ()
+  : m_nCommands (0),
+  m_size (0)
+{
+}
+
+bool
+MacCommandBuffer::Add (Ptr<MacCommand> command)
+{
+  NS_LOG_FUNCTION (this << command);
+
+  uint8_t commandSize = command->GetSerializedSize ();
+  if (m_nCommands == MAX_FOPTS_LENGTH
+      || m_size + commandSize > MAX_FOPTS_LENGTH)
+    {
+      NS_LOG_WARN ("FOpts field is full: dropping MAC command of CID " <<
+                   unsigned (MacCommand::GetCIDFromMacCommand
+                               (command->GetCommandType ())));
+      return false;
+    }
+
+  m_commands[m_nCommands++] = command;
+  m_size += commandSize;
+  return true;
+}
+
+void
+MacCommandBuffer::Clear (void)
+{
+  for (uint8_t i = 0; i < m_nCommands; i++)
+    {
+      m_commands[i] = 0;
+    }
+  m_nCommands = 0;
+  m_size = 0;
+}
+
+uint8_t
+MacCommandBuffer::GetN (void) const
+{
+  return m_nCommands;
+}
+
+uint8_t
+MacCommandBuffer::GetSerializedSize (void) const
+{
+  return m_size;
+}
+
+MacCommandBuffer::ConstIterator
+MacCommandBuffer::Begin (void) const
+{
+  return m_commands.data ();
+}
+
+MacCommandBuffer::ConstIterator
+MacCommandBuffer::End (void) const
+{
+  return m_commands.data () + m_nCommands;
+}
+
+////////////////////
+// MacCommandPool //
+////////////////////
+
+uint64_t MacCommandPool::m_nServed = 0;
+uint64_t MacCommandPool::m_nAllocated = 0;
+
+Ptr<LinkAdrAns>
+MacCommandPool::GetLinkAdrAns (bool powerAck, bool dataRateAck,
+                               bool channelMaskAck)
+{
+  static std::array<Ptr<LinkAdrAns>, 8> answers;
+
+  uint8_t index = (powerAck << 2) | (dataRateAck << 1) | channelMaskAck;
+  m_nServed++;
+  if (!answers[index])
+    {
+      answers[index] = CreateObject<LinkAdrAns> (powerAck, dataRateAck,
+                                                 channelMaskAck);
+      m_nAllocated++;
+    }
+  return answers[index];
+}
+
+Ptr<DutyCycleAns>
+MacCommandPool::GetDutyCycleAns (void)
+{
+  static Ptr<DutyCycleAns> answer;
+
+  m_nServed++;
+  if (!answer)
+    {
+      answer = CreateObject<DutyCycleAns> ();
+      m_nAllocated++;
+    }
+  return answer;
+}
+
+Ptr<RxParamSetupAns>
+MacCommandPool::GetRxParamSetupAns (bool rx1DrOffsetAck, bool rx2DataRateAck,
+                                    bool channelAck)
+{
+  static std::array<Ptr<RxParamSetupAns>, 8> answers;
+
+  uint8_t index = (rx1DrOffsetAck << 2) | (rx2DataRateAck << 1) | channelAck;
+  m_nServed++;
+  if (!answers[index])
+    {
+      answers[index] = CreateObject<RxParamSetupAns> (rx1DrOffsetAck,
+                                                      rx2DataRateAck,
+                                                      channelAck);
+      m_nAllocated++;
+    }
+  return answers[index];
+}
+
+Ptr<DevStatusAns>
+MacCommandPool::GetDevStatusAns (uint8_t battery, uint8_t margin)
+{
+  // Battery and margin can take many values, so only the pairs that are
+  // actually used get an entry
+  static std::map<uint16_t, Ptr<DevStatusAns> > answers;
+
+  Ptr<DevStatusAns> &answer = answers[(battery << 8) | margin];
+  m_nServed++;
+  if (!answer)
+    {
+      answer = CreateObject<DevStatusAns> (battery, margin);
+      m_nAllocated++;
+    }
+  return answer;
+}
+
+Ptr<NewChannelAns>
+MacCommandPool::GetNewChannelAns (bool dataRateRangeOk,
+                                  bool channelFrequencyOk)
+{
+  static std::array<Ptr<NewChannelAns>, 4> answers;
+
+  uint8_t index = (dataRateRangeOk << 1) | channelFrequencyOk;
+  m_nServed++;
+  if (!answers[index])
+    {
+      answers[index] = CreateObject<NewChannelAns> (dataRateRangeOk,
+                                                    channelFrequencyOk);
+      m_nAllocated++;
+    }
+  return answers[index];
+}
+
+uint64_t
+MacCommandPool::GetNServed (void)
+{
+  return m_nServed;
+}
+
+uint64_t
+MacCommandPool::GetNAllocated (void)
+{
+  return m_nAllocated;
+}
+
+} // namespace lorawan
+} // namespace ns3
@@ -0,0 +1,122 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MAC_COMMAND_POOL_H
+#define MAC_COMMAND_POOL_H
+
+#include "ns3/mac-command.h"
+#include <array>
+#include <map>
+
+namespace ns3 {
+namespace lorawan {
+
+/**
+ * Fixed-capacity container for the MAC commands an end device piggybacks on
+ * its next uplink.
+ *
+ * The FOpts field of a LoRaWAN frame is at most 15 bytes long and every MAC
+ * command takes at least one byte, so the buffer never needs more than 15
+ * entries and can be stored inline in the MAC instead of in a std::list.
+ */
+class MacCommandBuffer
+{
+public:
+  /**
+   * Maximum length of the FOpts field, in bytes.
+   */
+  static const uint8_t MAX_FOPTS_LENGTH = 15;
+
+  typedef const Ptr<MacCommand> *ConstIterator;
+
+  MacCommandBuffer ();
+
+  /**
+   * Append a command to the buffer.
+   *
+   * \param command The command to add.
+   * \return false if the command does not fit in the FOpts field anymore.
+   */
+  bool Add (Ptr<MacCommand> command);
+
+  /**
+   * Remove all commands from the buffer.
+   */
+  void Clear (void);
+
+  /**
+   * \return The number of commands in the buffer.
+   */
+  uint8_t GetN (void) const;
+
+  /**
+   * \return The number of FOpts bytes taken by the buffered commands.
+   */
+  uint8_t GetSerializedSize (void) const;
+
+  ConstIterator Begin (void) const;
+  ConstIterator End (void) const;
+
+private:
+  std::array<Ptr<MacCommand>, MAX_FOPTS_LENGTH> m_commands;
+  uint8_t m_nCommands;     //!< Number of valid entries in m_commands
+  uint8_t m_size;          //!< FOpts bytes used by the valid entries
+};
+
+/**
+ * Process-wide cache of the answers an end device sends back to the network
+ * server.
+ *
+ * Answers are never modified after construction, and the frame header only
+ * serializes them, so every device replying with the same fields can share
+ * the same object instead of allocating a new one on each downlink.
+ */
+class MacCommandPool
+{
+public:
+  static Ptr<LinkAdrAns> GetLinkAdrAns (bool powerAck, bool dataRateAck,
+                                        bool channelMaskAck);
+
+  static Ptr<DutyCycleAns> GetDutyCycleAns (void);
+
+  static Ptr<RxParamSetupAns> GetRxParamSetupAns (bool rx1DrOffsetAck,
+                                                  bool rx2DataRateAck,
+                                                  bool channelAck);
+
+  static Ptr<DevStatusAns> GetDevStatusAns (uint8_t battery, uint8_t margin);
+
+  static Ptr<NewChannelAns> GetNewChannelAns (bool dataRateRangeOk,
+                                              bool channelFrequencyOk);
+
+  /**
+   * \return The number of answers handed out so far.
+   */
+  static uint64_t GetNServed (void);
+
+  /**
+   * \return The number of answer objects actually allocated so far.
+   */
+  static uint64_t GetNAllocated (void);
+
+private:
+  static uint64_t m_nServed;
+  static uint64_t m_nAllocated;
+};
+
+} // namespace lorawan
+
+} // namespace ns3
+#endif /* MAC_COMMAND_POOL_H */